@@ -19,6 +19,7 @@ struct BVHBuildNode
     BoundingBox3f bounds;
     BVHBuildNode *children[2];
     int splitAxis; // leaf node set as 3
+    int nodeIndex;  // in build order, RasterBVH::_nodes[nodeIndex] is this node
     int firstPrimOffset;
     int nPrimitives;
 
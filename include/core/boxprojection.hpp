@@ -0,0 +1,53 @@
+#pragma once
+#include <core/base.hpp>
+#include <glm/glm.hpp>
+
+// NDC bounds of a projected box, the x / y rect and the nearest depth
+struct ProjectedBounds
+{
+    float xMin, yMin, xMax, yMax;
+    float zMin;
+};
+
+/***
+ * BoxProjector
+ *  Projects axis aligned boxes with a fixed transform m (to clip space, then divided by w)
+ *  By linearity the 8 corners of a box are m * (pMin, 1) plus any subset of the extent columns m[axis] * (pMax - pMin)[axis],
+ *  so a box costs one matrix-vector product and three column scales, the 8 corners, the divide and the min / max
+ *  are then done 8 wide in AVX registers (when compiled with AVX, a scalar loop otherwise)
+ *  The projection is only meaningful for boxes in front of the near plane, frustumTest() tells which ones are:
+ *  the six clip planes -w <= x, y, z <= w are taken from the rows of m once, so they are in the boxes' own space
+ */
+class BoxProjector
+{
+public:
+    // frustum planes, in the order of the bits of a plane mask
+    enum Plane
+    {
+        Left,
+        Right,
+        Bottom,
+        Top,
+        Near,
+        Far,
+        PlaneCount
+    };
+    static constexpr int AllPlanes = (1 << PlaneCount) - 1;
+
+    explicit BoxProjector(const glm::mat4 &m = glm::mat4(1.0f));
+
+    ProjectedBounds project(const BoundingBox3f &box) const;
+    // count boxes per call, 8 per pass with one box per lane (structure of arrays), from about 4 boxes on it is cheaper per box than project(box)
+    void project(const BoundingBox3f *boxes, int count, ProjectedBounds *out) const;
+    const glm::mat4 &matrix() const { return m; }
+
+    // false if the box is outside one of the planes in planeMask, otherwise the planes it is inside of are cleared from planeMask,
+    // children of the box only need the planes left
+    bool frustumTest(const BoundingBox3f &box, int &planeMask) const;
+    // stands in for the projection of a box crossing the near plane: the whole screen at the nearest depth
+    static ProjectedBounds unbounded();
+
+private:
+    glm::mat4 m;
+    glm::vec4 planes[PlaneCount]; // (n, d), a point p is inside when dot(n, p) + d >= 0
+};
@@ -1,8 +1,15 @@
 #pragma once
 #include <core/acceleration.hpp>
+#include <core/boxprojection.hpp>
 #include <core/memory.hpp>
 #include <obj_loader/objtype.hpp>
 #include <functional>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 struct BucketInfo
 {
@@ -24,6 +31,52 @@ public:
     Uint culledFaces{0};
 };
 
+// one bit per BVH node, indexed by BVHBuildNode::nodeIndex
+class NodeBitSet
+{
+public:
+    void resize(Uint n) { words.assign((n + 63) >> 6, 0); }
+    void clear() { std::fill(words.begin(), words.end(), 0); }
+    bool test(Uint i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    void set(Uint i) { words[i >> 6] |= 1ull << (i & 63); }
+    void swap(NodeBitSet &other) { words.swap(other.words); }
+    template <typename F>
+    void forEach(F &&fn) const // fn(i) for every set bit, in increasing order
+    {
+        for (Uint w = 0; w < words.size(); w++)
+            for (uint64_t bits = words[w]; bits; bits &= bits - 1) // drop the lowest set bit each step
+                fn((w << 6) + __lowestSetBit(bits));
+    }
+
+private:
+    std::vector<uint64_t> words;
+
+    static Uint __lowestSetBit(uint64_t bits) // bits != 0
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+};
+
+// the nodes' bounds after the current transform, indexed by nodeIndex: NDC rect and nearest depth
+// a node is only projected once traversal reaches it, frame tells which transform its entry belongs to
+struct NodeProjections
+{
+    std::vector<float> xMin, yMin, xMax, yMax, zMin;
+    std::vector<Uint> frame;
+
+    void resize(Uint n)
+    {
+        xMin.resize(n), yMin.resize(n), xMax.resize(n), yMax.resize(n), zMin.resize(n);
+        frame.assign(n, 0);
+    }
+};
+
 using BVHRenderCallBack = std::function<bool(BVHBuildNode *, RasterBVHContext &)>; // render callback
 using BVHDebugCallBack = std::function<bool(BoundingBox3f)>;
 class RasterBVH
@@ -36,9 +89,14 @@ class RasterBVH
      * Build a BVH for the scene, the bvh is this entire scene's bvh
      * How to build a BVH: just call the constructor, and the BVH will be built
      * implementTransform(): this function is used to implement the transform matrix to the BVH, it should be called before each render loop
-     * this function will not update the bvh, but will update the boundingbox class' camera space new boundings (pMinNew, pMaxNew)
+     * this function will not update the bvh, traverse() projects each node it reaches into _projections (NDC rect and min depth)
+     * before the visitor sees it, nodes below a culled one are never projected
      * traversalBVH(): this function is used to traversal the BVH, it should be called in the render segment shader
      * and the traversalRenderCallback should be set before calling this function
+     * traverse(visitor): the same traversal with the callback known at compile time, traversalBVH() wraps it (for debug use)
+     * children are visited front to back (by projected min depth) unless _frontToBack is off
+     * with _frustumCulling on, nodes outside the view frustum are dropped before they are projected or visited, each node carries
+     * the planes its parent was not fully inside of, and a node crossing the near plane gets BoxProjector::unbounded() as projection
      *
      * How to get the faces from the leaf node:
      *  the facesindex is stored in the orderedData, you can easily get the face by the index
@@ -77,15 +135,27 @@ public:
 
 private:
     std::vector<Uint> _faceInfo;
+    struct TraversalEntry
+    {
+        BVHBuildNode *node;
+        int planeMask; // frustum planes still to test below this node
+    };
+    std::vector<TraversalEntry> _traversalStack;
+    BoxProjector _projector;
+    Uint _frame{0}; // bumped by implementTransform
 
 public:
     Uint _totalNodes{0};
     BVHBuildNode *_root{nullptr};
+    std::vector<BVHBuildNode *> _nodes; // indexed by nodeIndex
     Uint _memorySize{0};
     BoundingBox3f _sceneBoundCurrent;
     int _depth{0};
     int _maxDepth{0};
     RasterBVHContext _context{};
+    bool _frontToBack{true}; // visit the child with the nearer projected min depth first
+    bool _frustumCulling{true};
+    NodeProjections _projections;
 
     BVHRenderCallBack _traversalRenderCallback;
     BVHDebugCallBack _traversalDebug; // draw bb debug
@@ -95,6 +165,8 @@ public:
         _arena = std::make_unique<MemoryArena>(memorySize * 1024 * 1024);
 
         __initBVH();
+        _traversalStack.resize(_maxDepth + 1); // enough for a depth first traversal
+        _projections.resize(_totalNodes);
         _context.totalFaces = faces.size();
         _context.totalNodes = _totalNodes;
         __printBVHInfo();
@@ -102,6 +174,9 @@ public:
     ~RasterBVH() = default;
     void implementTransform(glm::mat4 &m); // called before each render loop
     void traversalBVH();                   // called in the render segment shader
+    // visitor(node, context) returns false to skip the node's children, like _traversalRenderCallback
+    template <typename Visitor>
+    void traverse(Visitor &&visitor);
 
     static BoundingBox3f getBBfromFace(const Face &face, const std::vector<Vertex> &vertices)
     {
@@ -124,6 +199,117 @@ private:
     BVHBuildNode *__recursiveBuild(int start, int end);
     BVHBuildNode *__recursiveBuildSAH(int start, int end);
 
-    void __traversalBVH(BVHBuildNode *node);
-    void __implementTransform(glm::mat4 &m, BVHBuildNode *node);
-};
\ No newline at end of file
+    void __project(const BVHBuildNode *node, int planeMask);
+    bool __enter(BVHBuildNode *node, int planeMask, TraversalEntry &entry); // false if the node is outside the frustum
+};
+
+template <typename Visitor>
+void RasterBVH::traverse(Visitor &&visitor)
+{
+    assert(_root != nullptr && "BVH root is nullptr");
+    if (_root == nullptr)
+        return;
+
+    _context.culledNodes = _totalNodes;
+    _context.culledFaces = _context.totalFaces;
+    TraversalEntry *stack = _traversalStack.data();
+    int top = 0;
+    if (__enter(_root, _frustumCulling ? BoxProjector::AllPlanes : 0, stack[top]))
+        top++;
+    while (top > 0)
+    {
+        TraversalEntry entry = stack[--top];
+        BVHBuildNode *node = entry.node;
+        if (!visitor(node, _context)) // if the node is culled(only for internal nodes)
+            continue;
+        _context.culledNodes--;
+        if (node->splitAxis == 3) // leaf node
+            continue;
+        TraversalEntry children[2];
+        bool inside[2] = {__enter(node->children[0], entry.planeMask, children[0]),
+                          __enter(node->children[1], entry.planeMask, children[1])};
+        // nearer child first, so what it draws can occlude the other one, it is pushed last
+        const std::vector<float> &zMin = _projections.zMin;
+        int first = _frontToBack && inside[0] && inside[1] && zMin[node->children[1]->nodeIndex] < zMin[node->children[0]->nodeIndex];
+        if (inside[1 - first])
+            stack[top++] = children[1 - first];
+        if (inside[first])
+            stack[top++] = children[first];
+    }
+}
+
+/***
+ * InstanceBVH
+ *  Top level BVH over the world space bounds of object instances (one leaf per instance), the instances keep their own
+ *  RasterBVH in object space, so moving or toggling an object only rebuilds this small tree (median split on the longest axis)
+ *  traverse(): all nodes are projected with the projector up front, in batches (the tree is small), with frustumCulling
+ *  nodes outside its frustum are dropped, and nodes crossing the near plane use unbounded() instead, children nearest first
+ */
+class InstanceBVH
+{
+public:
+    struct Node
+    {
+        BoundingBox3f bounds; // world space
+        int children[2];      // -1 for a leaf
+        int instance;         // leaf only, the id given to build()
+    };
+    std::vector<Node> nodes; // nodes[0] is the root, empty when there are no instances
+
+    void build(const std::vector<BoundingBox3f> &bounds, const std::vector<int> &instances); // bounds indexed by instance id
+    // visitor(node, projected) returns false to skip the node's children
+    template <typename Visitor>
+    void traverse(const BoxProjector &projector, bool frontToBack, bool frustumCulling, Visitor &&visitor);
+
+private:
+    struct Entry
+    {
+        int index;
+        int planeMask; // frustum planes still to test below this node
+    };
+    std::vector<Entry> stack;
+    std::vector<BoundingBox3f> boxes;        // node bounds, gathered for the batched projection
+    std::vector<ProjectedBounds> projected; // indexed like nodes
+    int __build(std::vector<int> &items, int begin, int end, const std::vector<BoundingBox3f> &bounds);
+};
+
+template <typename Visitor>
+void InstanceBVH::traverse(const BoxProjector &projector, bool frontToBack, bool frustumCulling, Visitor &&visitor)
+{
+    if (nodes.empty())
+        return;
+    boxes.resize(nodes.size());
+    projected.resize(nodes.size());
+    for (int i = 0; i < nodes.size(); i++)
+        boxes[i] = nodes[i].bounds;
+    projector.project(boxes.data(), boxes.size(), projected.data());
+    // corners behind the camera divide by a negative w, the rect they give is meaningless
+    auto bounds = [this](const Entry &entry)
+    { return entry.planeMask & (1 << BoxProjector::Near) ? BoxProjector::unbounded() : projected[entry.index]; };
+
+    stack.clear();
+    int rootMask = frustumCulling ? BoxProjector::AllPlanes : 0;
+    if (!projector.frustumTest(nodes[0].bounds, rootMask))
+        return;
+    stack.push_back({0, rootMask});
+    while (!stack.empty())
+    {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const Node &node = nodes[entry.index];
+        if (!visitor(node, bounds(entry)) || node.instance >= 0)
+            continue;
+        Entry children[2];
+        bool inside[2];
+        for (int i = 0; i < 2; i++)
+        {
+            children[i] = {node.children[i], entry.planeMask};
+            inside[i] = projector.frustumTest(nodes[children[i].index].bounds, children[i].planeMask);
+        }
+        int first = frontToBack && bounds(children[1]).zMin < bounds(children[0]).zMin; // pushed last
+        if (inside[1 - first])
+            stack.push_back(children[1 - first]);
+        if (inside[first])
+            stack.push_back(children[first]);
+    }
+}
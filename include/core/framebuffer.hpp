@@ -0,0 +1,149 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+#include <obj_loader/objtype.hpp>
+
+/***
+ * TiledLayout
+ *  Maps a pixel (x, y) to its offset inside a framebuffer
+ *  Row-major: offset = y * width + x
+ *  Tiled: the screen is split into TileSize x TileSize tiles stored one after another (row-major over tiles),
+ *  pixels inside a tile are stored in Morton (Z) order, so a tile is one contiguous 256 byte block of floats
+ *
+ *  Buffers using this layout must be allocated with size() elements, which pads the screen to whole tiles
+ */
+class TiledLayout
+{
+public:
+    static constexpr int TileShift = 3;
+    static constexpr int TileSize = 1 << TileShift; // 8x8 pixels per tile
+    static constexpr int TileMask = TileSize - 1;
+    static constexpr int PixelPerTile = TileSize * TileSize;
+
+    int width, height;
+    int tileCountX, tileCountY;
+    bool tiled{false};
+
+    TiledLayout(int width, int height) : width(width), height(height)
+    {
+        tileCountX = (width + TileMask) >> TileShift;
+        tileCountY = (height + TileMask) >> TileShift;
+    }
+
+    int size() const { return tileCountX * tileCountY * PixelPerTile; }
+
+    int index(int x, int y) const
+    {
+        if (!tiled)
+            return y * width + x;
+        int tileId = (y >> TileShift) * tileCountX + (x >> TileShift);
+        return (tileId << (2 * TileShift)) | morton(x & TileMask, y & TileMask);
+    }
+
+    // interleave the bits of x and y (x in even bits), only the low TileShift bits are used
+    static int morton(int x, int y)
+    {
+        return __spreadBits(x) | (__spreadBits(y) << 1);
+    }
+
+private:
+    static int __spreadBits(int v)
+    {
+        v = (v | (v << 2)) & 0x33;
+        v = (v | (v << 1)) & 0x55;
+        return v;
+    }
+};
+
+/***
+ * DirtyTileSet
+ *  Remembers which TiledLayout tiles have been written since the last clear, so a clear only touches those
+ *  Writers mark what they touch (a conservative rectangle is fine), clear() resets the dirty tiles to a value
+ *  A new set starts with every tile dirty, since the buffers behind it are uninitialized
+ */
+class DirtyTileSet
+{
+public:
+    int tileCountX, tileCountY;
+
+    DirtyTileSet(int width, int height) : width(width), height(height)
+    {
+        TiledLayout layout(width, height);
+        tileCountX = layout.tileCountX;
+        tileCountY = layout.tileCountY;
+        dirty.resize(tileCountX * tileCountY, 0);
+        dirtyList.reserve(tileCountX * tileCountY);
+        markAll();
+    }
+
+    void markAll() { markRect(0, 0, width - 1, height - 1); }
+    void markPixel(int x, int y) { markRect(x, y, x, y); }
+    void markRect(int xMin, int yMin, int xMax, int yMax) // inclusive pixel bounds, clamped to the screen
+    {
+        xMin = xMin < 0 ? 0 : xMin;
+        yMin = yMin < 0 ? 0 : yMin;
+        xMax = xMax > width - 1 ? width - 1 : xMax;
+        yMax = yMax > height - 1 ? height - 1 : yMax;
+        if (xMin > xMax || yMin > yMax)
+            return;
+        for (int ty = yMin >> TiledLayout::TileShift; ty <= yMax >> TiledLayout::TileShift; ty++)
+            for (int tx = xMin >> TiledLayout::TileShift; tx <= xMax >> TiledLayout::TileShift; tx++)
+            {
+                int tileId = ty * tileCountX + tx;
+                if (dirty[tileId])
+                    continue;
+                dirty[tileId] = 1;
+                dirtyList.push_back(tileId);
+            }
+    }
+    int dirtyCount() const { return dirtyList.size(); }
+
+    const std::vector<int> &dirtyTileIds() const { return dirtyList; }
+
+    // calls fn(begin, end) for the contiguous pixel index ranges of one tile: a single range when tiled, one per row otherwise
+    template <typename F>
+    void forEachRun(int tileId, bool tiled, F &&fn) const
+    {
+        if (tiled)
+        {
+            fn(tileId * TiledLayout::PixelPerTile, (tileId + 1) * TiledLayout::PixelPerTile);
+            return;
+        }
+        int x0 = (tileId % tileCountX) << TiledLayout::TileShift, y0 = (tileId / tileCountX) << TiledLayout::TileShift;
+        int x1 = x0 + TiledLayout::TileSize < width ? x0 + TiledLayout::TileSize : width;
+        int y1 = y0 + TiledLayout::TileSize < height ? y0 + TiledLayout::TileSize : height;
+        for (int y = y0; y < y1; y++)
+            fn(y * width + x0, y * width + x1);
+    }
+
+    // fill the dirty tiles of one buffer (row-major or tiled) with value, call it for every buffer sharing the set before reset()
+    template <typename T>
+    void clear(T *data, int channels, T value, bool tiled = false) const
+    {
+        for (int tileId : dirtyList)
+            forEachRun(tileId, tiled, [&](int begin, int end)
+                       { std::fill(data + begin * channels, data + end * channels, value); });
+    }
+    void merge(const DirtyTileSet &other) // mark every tile dirty in other, both sets must cover the same screen
+    {
+        for (int tileId : other.dirtyList)
+        {
+            if (dirty[tileId])
+                continue;
+            dirty[tileId] = 1;
+            dirtyList.push_back(tileId);
+        }
+    }
+    void reset()
+    {
+        for (int tileId : dirtyList)
+            dirty[tileId] = 0;
+        dirtyList.clear();
+    }
+
+private:
+    int width, height;
+    std::vector<Uchar> dirty;
+    std::vector<int> dirtyList;
+};
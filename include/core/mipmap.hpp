@@ -1,72 +1,102 @@
 #pragma once
-#include <iostream>
 #include <algorithm>
+#include <limits>
 #include <vector>
-#include <cmath>
 
 #include <obj_loader/objtype.hpp>
 struct MipMapOneLvl
 {
     int width, height;
-    float *data;
+    std::vector<float> data;
     float &operator()(int x, int y)
     {
         return data[y * width + x];
     }
-    bool *mask;
+    float operator()(int x, int y) const
+    {
+        return data[y * width + x];
+    }
 };
+
+/***
+ * MipMap
+ *  Max-depth pyramid over a row-major depth buffer (the base, not stored here)
+ *  mipMap[i] is level i + 1, its texel (x, y) holds the max depth of the base pixels [x << (i + 1), (x + 1) << (i + 1)) in x and y,
+ *  level sizes round up so the last row / column of texels covers the screen edge, the top level is 1x1
+ *  Queries are conservative: the max they return is never less than the max of the pixels asked for
+ */
 class MipMap
 {
 public:
     int width, height;
     std::vector<MipMapOneLvl> mipMap;
-    MipMap(int width, int height, float initValue = -std::numeric_limits<float>::infinity()) : width(width), height(height)
+    MipMap(int width, int height, float initValue = std::numeric_limits<float>::infinity()) : width(width), height(height)
     {
-        int maxLevel = log2(Max2(width, height));
-        mipMap.resize(maxLevel);
-        for (int i = 0; i < maxLevel; i++)
+        int w = width, h = height;
+        while (w > 1 || h > 1)
         {
-            mipMap[i].width = Max2(1, width >> (i + 1));
-            mipMap[i].height = Max2(1, height >> (i + 1));
-            mipMap[i].data = new float[mipMap[i].width * mipMap[i].height];
-            mipMap[i].mask = new bool[mipMap[i].width * mipMap[i].height];
-            std::fill(mipMap[i].data, mipMap[i].data + mipMap[i].width * mipMap[i].height, initValue);
-            std::fill(mipMap[i].mask, mipMap[i].mask + mipMap[i].width * mipMap[i].height, false);
+            w = (w + 1) >> 1;
+            h = (h + 1) >> 1;
+            MipMapOneLvl level;
+            level.width = w;
+            level.height = h;
+            level.data.resize(w * h, initValue);
+            mipMap.push_back(std::move(level));
         }
     }
-    ~MipMap()
-    {
-        for (int i = 0; i < mipMap.size(); i++)
-            delete[] mipMap[i].data;
-    }
+    ~MipMap() = default;
 
-    void getMipMapBB(int level, int pixelX, int pixelY, Uint2 &bbMin, Uint2 &bbMax)
+    void reset(float value = std::numeric_limits<float>::infinity())
     {
-        bbMin = Uint2(Max2(0, pixelX >> (level + 1)), Max2(0, pixelY >> (level + 1)));
-        bbMax = Uint2(Min2(mipMap[level].width - 1, pixelX >> level), Min2(mipMap[level].height - 1, pixelY >> level));
+        for (auto &level : mipMap)
+            std::fill(level.data.begin(), level.data.end(), value);
     }
 
-    void findMinBBPixel(Uint2 bbMin, Uint2 bbMax, int &lvl, int &pixelX, int &pixelY)
+    // the base pixels in [xMin, xMax] x [yMin, yMax] (inclusive, on screen) changed, refresh the texels above them
+    void update(const float *base, int xMin, int yMin, int xMax, int yMax)
     {
-        for (int i = mipMap.size() - 1; i >= 0; i--)
+        for (int i = 0; i < mipMap.size(); i++)
         {
-            Uint2 bbMinTmp, bbMaxTmp;
-            for (int j = bbMin.y; j <= bbMax.y; j++)
-                for (int k = bbMin.x; k <= bbMax.x; k++)
+            xMin >>= 1, yMin >>= 1, xMax >>= 1, yMax >>= 1;
+            bool changed = false;
+            for (int y = yMin; y <= yMax; y++)
+                for (int x = xMin; x <= xMax; x++)
                 {
-                    getMipMapBB(i, k, j, bbMinTmp, bbMaxTmp);
-                    if (bbMaxTmp.x >= bbMin.x && bbMaxTmp.y >= bbMin.y && bbMinTmp.x <= bbMax.x && bbMinTmp.y <= bbMax.y)
-                    {
-                        lvl = i;
-                        pixelX = k;
-                        pixelY = j;
-                        std::cout << "bbMin: " << bbMin.x << " " << bbMin.y << " bbMax: " << bbMax.x << " " << bbMax.y << std::endl;
-                        std::cout << "findMinBBPixel: " << lvl << " " << pixelX << " " << pixelY << std::endl;
-
-                        return;
-                    }
+                    float maxZ = __childMax(base, i, x, y);
+                    if (mipMap[i](x, y) == maxZ)
+                        continue;
+                    mipMap[i](x, y) = maxZ;
+                    changed = true;
                 }
+            if (!changed) // the levels above only read this one
+                return;
         }
-        assert(false && "findMinBBPixel: not found");
     }
-};
\ No newline at end of file
+
+    // max depth over the base pixels [xMin, xMax] x [yMin, yMax] (inclusive, on screen), from the finest level where the rect spans at most 2x2 texels
+    float maxDepth(const float *base, int xMin, int yMin, int xMax, int yMax) const
+    {
+        int lvl = 0;
+        while ((xMax >> lvl) - (xMin >> lvl) > 1 || (yMax >> lvl) - (yMin >> lvl) > 1)
+            lvl++;
+        int x0 = xMin >> lvl, x1 = xMax >> lvl;
+        int y0 = yMin >> lvl, y1 = yMax >> lvl;
+        if (lvl == 0)
+            return std::max(std::max(base[y0 * width + x0], base[y0 * width + x1]), std::max(base[y1 * width + x0], base[y1 * width + x1]));
+        auto &level = mipMap[lvl - 1];
+        return std::max(std::max(level(x0, y0), level(x1, y0)), std::max(level(x0, y1), level(x1, y1)));
+    }
+
+private:
+    // max of the (up to) 2x2 texels below texel (x, y) of mipMap[i]
+    float __childMax(const float *base, int i, int x, int y) const
+    {
+        int childWidth = i == 0 ? width : mipMap[i - 1].width;
+        int childHeight = i == 0 ? height : mipMap[i - 1].height;
+        const float *child = i == 0 ? base : mipMap[i - 1].data.data();
+        int cx0 = x << 1, cx1 = std::min(cx0 + 1, childWidth - 1);
+        int cy0 = y << 1, cy1 = std::min(cy0 + 1, childHeight - 1);
+        return std::max(std::max(child[cy0 * childWidth + cx0], child[cy0 * childWidth + cx1]),
+                        std::max(child[cy1 * childWidth + cx0], child[cy1 * childWidth + cx1]));
+    }
+};
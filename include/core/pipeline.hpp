@@ -0,0 +1,188 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <obj_loader/objtype.hpp>
+
+/***
+ * Pipeline
+ *  A compile-time specialized triangle pipeline for the cpu rasterizers
+ *  VertexShader: projects a vertex to screen space, and picks the attributes (Varyings) to interpolate
+ *  FragmentShader: turns the interpolated Varyings into a color, or writes no color at all (depth only)
+ *
+ *  The number of varyings, the depth test and the face culling are template parameters,
+ *  so every configuration gets its own raster loop with no branches or unused attributes in it
+ *
+ *  Usage: NormalColorPipeline<>().drawTriangle(v0, v1, v2, xStart, xEnd, yStart, yEnd, zBuffer, colorBuffer, layout)
+ *  layout is anything with index(x, y), e.g. TiledLayout
+ */
+enum class DepthTest
+{
+    Less,
+    LessEqual,
+    Always,
+};
+
+enum class CullMode
+{
+    None,
+    Back, // counter-clockwise on screen is front
+    Front,
+};
+
+template <int N>
+struct Varyings
+{
+    static constexpr int Count = N;
+    float value[N > 0 ? N : 1];
+};
+
+// vertex shaders
+struct ScreenSpaceVertexShader
+{
+    Vertex operator()(const Vertex &v, const glm::mat4 &mvp, int width, int height) const
+    {
+        glm::vec4 v4(v.x, v.y, v.z, 1.0f);
+        v4 = mvp * v4;
+        Vertex vertex(v4.x / v4.w, v4.y / v4.w, v4.z / v4.w);
+        vertex.x = (vertex.x + 1.0f) * width / 2.0f;
+        vertex.y = (vertex.y + 1.0f) * height / 2.0f;
+        vertex.nx = v.nx;
+        vertex.ny = v.ny;
+        vertex.nz = v.nz;
+        return vertex;
+    }
+};
+
+struct NormalVertexShader : ScreenSpaceVertexShader // interpolate the normal
+{
+    using Varyings = ::Varyings<3>;
+    Varyings varyings(const Vertex &v) const { return Varyings{{v.nx, v.ny, v.nz}}; }
+};
+
+struct PositionVertexShader : ScreenSpaceVertexShader // interpolate nothing but depth
+{
+    using Varyings = ::Varyings<0>;
+    Varyings varyings(const Vertex &) const { return Varyings{}; }
+};
+
+// fragment shaders
+struct NormalColorFragmentShader
+{
+    static constexpr bool WritesColor = true;
+    void operator()(const Varyings<3> &in, float *rgb) const
+    {
+        rgb[0] = in.value[0];
+        rgb[1] = in.value[1];
+        rgb[2] = in.value[2];
+    }
+};
+
+struct FlatColorFragmentShader
+{
+    static constexpr bool WritesColor = true;
+    float r{0.8f}, g{0.8f}, b{0.8f};
+    template <int N>
+    void operator()(const Varyings<N> &, float *rgb) const
+    {
+        rgb[0] = r;
+        rgb[1] = g;
+        rgb[2] = b;
+    }
+};
+
+struct DepthOnlyFragmentShader
+{
+    static constexpr bool WritesColor = false;
+    template <int N>
+    void operator()(const Varyings<N> &, float *) const {}
+};
+
+template <typename VertexShader, typename FragmentShader, typename VaryingsType = typename VertexShader::Varyings,
+          DepthTest Depth = DepthTest::Less, CullMode Cull = CullMode::None>
+class Pipeline
+{
+public:
+    static constexpr int VaryingCount = VaryingsType::Count;
+    VertexShader vertexShader;
+    FragmentShader fragmentShader;
+
+    Pipeline(const VertexShader &vertexShader = VertexShader(), const FragmentShader &fragmentShader = FragmentShader())
+        : vertexShader(vertexShader), fragmentShader(fragmentShader) {}
+
+    static bool depthTest(float z, float stored)
+    {
+        if constexpr (Depth == DepthTest::Less)
+            return z < stored;
+        else if constexpr (Depth == DepthTest::LessEqual)
+            return z <= stored;
+        else
+            return true;
+    }
+
+    static bool culled(const Vertex &v0, const Vertex &v1, const Vertex &v2)
+    {
+        if constexpr (Cull == CullMode::None)
+            return false;
+        float area2 = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if constexpr (Cull == CullMode::Back)
+            return area2 <= 0.0f;
+        else
+            return area2 >= 0.0f;
+    }
+
+    // interpolate the varyings and run the fragment shader, for a fragment that passed the depth test
+    void shade(const Vertex &v0, const Vertex &v1, const Vertex &v2, float lambda1, float lambda2, float lambda3, float *rgb) const
+    {
+        if constexpr (FragmentShader::WritesColor)
+        {
+            VaryingsType a0 = vertexShader.varyings(v0);
+            VaryingsType a1 = vertexShader.varyings(v1);
+            VaryingsType a2 = vertexShader.varyings(v2);
+            VaryingsType in;
+            for (int i = 0; i < VaryingCount; i++)
+                in.value[i] = lambda1 * a0.value[i] + lambda2 * a1.value[i] + lambda3 * a2.value[i];
+            fragmentShader(in, rgb);
+        }
+    }
+
+    // rasterize the part of a screen space triangle inside [xStart, xEnd] x [yStart, yEnd], pixel centers on integers
+    template <typename Layout>
+    void drawTriangle(const Vertex &v0, const Vertex &v1, const Vertex &v2, int xStart, int xEnd, int yStart, int yEnd,
+                      float *zBuffer, float *colorBuffer, const Layout &layout) const
+    {
+        if (culled(v0, v1, v2))
+            return;
+        rasterizeTriangle(v0, v1, v2, xStart, xEnd, yStart, yEnd, zBuffer, colorBuffer, layout);
+    }
+
+    // drawTriangle() without the face culling test, for callers that culled the triangle already (and draw it in pieces)
+    template <typename Layout>
+    void rasterizeTriangle(const Vertex &v0, const Vertex &v1, const Vertex &v2, int xStart, int xEnd, int yStart, int yEnd,
+                           float *zBuffer, float *colorBuffer, const Layout &layout) const
+    {
+        float area = 0.5f * (-v1.y * v2.x + v0.y * (-v1.x + v2.x) + v0.x * (v1.y - v2.y) + v1.x * v2.y);
+        float invArea2 = 1 / (2 * area);
+        for (int y = yStart; y <= yEnd; y++)
+            for (int x = xStart; x <= xEnd; x++)
+            {
+                float lambda2 = invArea2 * (v0.y * v2.x - v0.x * v2.y + (v2.y - v0.y) * x + (v0.x - v2.x) * y);
+                float lambda3 = invArea2 * (v0.x * v1.y - v0.y * v1.x + (v0.y - v1.y) * x + (v1.x - v0.x) * y);
+                float lambda1 = 1 - lambda2 - lambda3;
+                if (!(lambda1 >= 0 && lambda2 >= 0 && 1 - lambda1 - lambda2 >= 0))
+                    continue;
+                float z = lambda1 * v0.z + lambda2 * v1.z + lambda3 * v2.z;
+                int index = layout.index(x, y);
+                if (!depthTest(z, zBuffer[index]))
+                    continue;
+                zBuffer[index] = z;
+                shade(v0, v1, v2, lambda1, lambda2, lambda3, colorBuffer + index * 3);
+            }
+    }
+};
+
+template <CullMode Cull = CullMode::None>
+using NormalColorPipeline = Pipeline<NormalVertexShader, NormalColorFragmentShader, Varyings<3>, DepthTest::Less, Cull>;
+template <CullMode Cull = CullMode::None>
+using FlatColorPipeline = Pipeline<PositionVertexShader, FlatColorFragmentShader, Varyings<0>, DepthTest::Less, Cull>;
+template <CullMode Cull = CullMode::None>
+using DepthOnlyPipeline = Pipeline<PositionVertexShader, DepthOnlyFragmentShader, Varyings<0>, DepthTest::Less, Cull>;
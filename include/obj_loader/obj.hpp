@@ -16,12 +16,21 @@ public:
     void addNormal(const Normal &n) { normals.push_back(n); }
     void addUV(const TexutreUV &uv) { uvs.push_back(uv); }
     void addFace(const Face &f) { faces.push_back(f); }
+    void addPolygon(const VertexIndex *indices, int count)
+    {
+        polygonIndices.insert(polygonIndices.end(), indices, indices + count);
+        polygonOffsets.push_back(polygonIndices.size());
+    }
 
     std::string getFileName() const { return file_name; }
     const std::vector<Vertex> &getVertices() const { return vertices; }
     const std::vector<Normal> &getNormals() const { return normals; }
     const std::vector<TexutreUV> &getUVs() const { return uvs; }
     const std::vector<Face> &getFaces() const { return faces; }
+    // faces as written in the file (convex, 3 or more vertices), polygon i is polygonIndices[polygonOffsets[i]] .. [polygonOffsets[i + 1] - 1]
+    int getPolygonCount() const { return polygonOffsets.size() - 1; }
+    const std::vector<VertexIndex> &getPolygonIndices() const { return polygonIndices; }
+    const std::vector<int> &getPolygonOffsets() const { return polygonOffsets; }
 
     void printSummary() const
     {
@@ -30,6 +39,7 @@ public:
         std::cout << "Normals:  " << normals.size() << std::endl;
         std::cout << "UVs:      " << uvs.size() << std::endl;
         std::cout << "Faces:    " << faces.size() << std::endl;
+        std::cout << "Polygons: " << getPolygonCount() << std::endl;
     }
 
     void implementTransform(const glm::mat4 &transform)
@@ -95,7 +105,9 @@ private:
     std::vector<Vertex> vertices;
     std::vector<Normal> normals;
     std::vector<TexutreUV> uvs;
-    std::vector<Face> faces;
+    std::vector<Face> faces; // triangles, n-gons are split into fans
+    std::vector<VertexIndex> polygonIndices;
+    std::vector<int> polygonOffsets{0};
 
     // gpu
     unsigned int VBO, VAO, EBO;
@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <obj_loader/objtype.hpp>
 #include <obj_loader/obj.hpp>
@@ -20,10 +21,14 @@ private:
     Vertex __parseVertex(const std::string &line);
     Normal __parseNormal(const std::string &line);
     TexutreUV __parseUV(const std::string &line);
-    Face __parseFace(const std::string &line);
+    void __parseFace(const std::string &line); // adds the face as triangles and as a polygon
+    bool __isConvex(const std::vector<VertexIndex> &indices) const;
     std::string file_name;
     std::string file_content;
     std::unique_ptr<OBJ> obj;
+    std::vector<VertexIndex> faceVertexIndices; // of the face being parsed
+    std::vector<TextureUVIndex> faceUVIndices;
+    std::vector<NormalIndex> faceNormalIndices;
 
     // utils
     void __autoAddNormal();
@@ -1,9 +1,12 @@
 #pragma once
+#include <core/framebuffer.hpp>
 
+// writers that do not overwrite the whole texture map must mark the pixels they touch,
+// clearTextureMap() only clears the tiles marked since the last clear
 class Canvas
 {
 public:
-    Canvas(int width, int height) : width(width), height(height)
+    Canvas(int width, int height) : width(width), height(height), dirtyTiles(width, height)
     {
         __allocMap();
     }
@@ -17,17 +20,21 @@ public:
         this->height = height;
         __freeMap();
         __allocMap();
+        dirtyTiles = DirtyTileSet(width, height);
     }
 
     void clearTextureMap()
     {
-        memset(textureMap, 0, width * height * 3);
+        dirtyTiles.clear(textureMap, 3, (char)0);
+        dirtyTiles.reset();
     }
+    void markDirty(int x, int y) { dirtyTiles.markPixel(x, y); }
 
     void setRandomTextureMap()
     {
         for (int i = 0; i < width * height * 3; i++)
             textureMap[i] = rand() % 256;
+        dirtyTiles.markAll();
     }
 
     char *getTextureMap() const { return textureMap; }
@@ -46,4 +53,5 @@ private:
     }
     int width, height;
     char *textureMap;
+    DirtyTileSet dirtyTiles;
 };
\ No newline at end of file
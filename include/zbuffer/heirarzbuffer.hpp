@@ -13,6 +13,8 @@ public:
     Uint pixelPerTileX, pixelPerTileY;
     Uint tileCountX, tileCountY;
     float *maxZ;
+    std::vector<Uchar> stale; // tiles whose maxZ may be too high, listed in staleList
+    std::vector<Uint> staleList;
     EzHeirarZBuffer(int width, int height, float *zBufferData, float *colorBufferData, Uint pixelPerTileX = 32, Uint pixelPerTileY = 32)
         : width(width), height(height), pixelPerTileX(pixelPerTileX), pixelPerTileY(pixelPerTileY), zBufferData(zBufferData), colorBufferData(colorBufferData)
     {
@@ -24,6 +26,7 @@ public:
             tileCountY++;
         maxZ = new float[tileCountX * tileCountY];
         std::fill(maxZ, maxZ + tileCountX * tileCountY, std::numeric_limits<float>::infinity());
+        stale.resize(tileCountX * tileCountY, 0);
 
         std::cout << "EzHeirarZBuffer construction done" << std::endl;
         std::cout << "Have " << tileCountX << " tiles in x direction, and " << tileCountY << " tiles in y direction" << std::endl;
@@ -38,20 +41,50 @@ public:
             return;
         std::fill(maxZ, maxZ + tileCountX * tileCountY, std::numeric_limits<float>::infinity());
     }
-    bool ifTileNeedRender(Sint2 bbpMin, Sint2 bbpMax, Uint idx, Uint idy, float bbMinZ)
+
+    // the tiles overlapped by a pixel rect (inclusive bounds), false if it is off screen
+    bool tileRange(Sint2 bbpMin, Sint2 bbpMax, Uint &fromX, Uint &fromY, Uint &toX, Uint &toY) const
     {
-        assert(idx < tileCountX && idy < tileCountY && "ifTileNeedRender: idx or idy out of range");
-        int pxMin = idx * pixelPerTileX, pxMax = (idx + 1) * pixelPerTileX;
-        int pyMin = idy * pixelPerTileY, pyMax = (idy + 1) * pixelPerTileY;
-        pxMax = pxMax >= width ? width - 1 : pxMax;
-        pyMax = pyMax >= height ? height - 1 : pyMax;
-        if (bbpMin.x > pxMax || bbpMax.x < pxMin || bbpMin.y > pyMax || bbpMax.y < pyMin)
+        if (bbpMin.x > width - 1 || bbpMax.x < 0 || bbpMin.y > height - 1 || bbpMax.y < 0)
             return false;
+        fromX = (bbpMin.x < 0 ? 0 : bbpMin.x) / pixelPerTileX;
+        fromY = (bbpMin.y < 0 ? 0 : bbpMin.y) / pixelPerTileY;
+        toX = (bbpMax.x > width - 1 ? width - 1 : bbpMax.x) / pixelPerTileX;
+        toY = (bbpMax.y > height - 1 ? height - 1 : bbpMax.y) / pixelPerTileY;
+        return true;
+    }
+    bool ifTileNeedRender(Uint idx, Uint idy, float bbMinZ) const
+    {
+        assert(idx < tileCountX && idy < tileCountY && "ifTileNeedRender: idx or idy out of range");
         if (!activated)
             return true;
-        if (bbMinZ < maxZ[idy * tileCountX + idx])
-            return true;
-        return false;
+        return bbMinZ < maxZ[idy * tileCountX + idx];
+    }
+
+    // a triangle with nearest depth minZ wrote inside the pixel rect (inclusive, on screen),
+    // its tiles are recomputed by updateStaleTiles() only if it could have lowered their max
+    void markWritten(int xMin, int yMin, int xMax, int yMax, float minZ)
+    {
+        if (!activated)
+            return;
+        for (Uint idy = yMin / pixelPerTileY; idy <= yMax / pixelPerTileY; idy++)
+            for (Uint idx = xMin / pixelPerTileX; idx <= xMax / pixelPerTileX; idx++)
+            {
+                Uint tileId = idy * tileCountX + idx;
+                if (stale[tileId] || minZ >= maxZ[tileId]) // LessEqual writes at or behind the max leave it as it is
+                    continue;
+                stale[tileId] = 1;
+                staleList.push_back(tileId);
+            }
+    }
+    void updateStaleTiles()
+    {
+        for (Uint tileId : staleList)
+        {
+            updateTileMaxZ(tileId % tileCountX, tileId / tileCountX);
+            stale[tileId] = 0;
+        }
+        staleList.clear();
     }
 
     void updateTileMaxZ(Uint idx, Uint idy)
@@ -60,11 +93,15 @@ public:
             return;
         assert(idx < tileCountX && idy < tileCountY && "updateTileMaxZ: idx or idy out of range");
         float maxZ_ = -std::numeric_limits<float>::infinity();
-        int xMin = idx * pixelPerTileX, xMax = (idx + 1) * pixelPerTileX;
-        int yMin = idy * pixelPerTileY, yMax = (idy + 1) * pixelPerTileY;
-        for (int i = yMin; i < yMax && i < height; i++)
-            for (int j = xMin; j < xMax && j < width; j++)
-                maxZ_ = maxZ_ < zBufferData[i * width + j] ? zBufferData[i * width + j] : maxZ_;
+        int xMin = idx * pixelPerTileX, xMax = std::min((idx + 1) * pixelPerTileX, (Uint)width);
+        int yMin = idy * pixelPerTileY, yMax = std::min((idy + 1) * pixelPerTileY, (Uint)height);
+        for (int i = yMin; i < yMax; i++)
+        {
+            const float *row = zBufferData + i * width;
+#pragma omp simd reduction(max : maxZ_)
+            for (int j = xMin; j < xMax; j++)
+                maxZ_ = maxZ_ < row[j] ? row[j] : maxZ_;
+        }
         maxZ[idy * tileCountX + idx] = maxZ_;
     }
 
@@ -89,6 +126,11 @@ public:
     }
 };
 
+/***
+ * HeirarZBuffer
+ *  Max-depth pyramid over zBufferData, a screen rect whose nearest depth is behind the max depth of every pixel under it is occluded
+ *  Call update() for the pixels a draw changed, and reset() after the depth buffer is cleared
+ */
 class HeirarZBuffer
 {
 public:
@@ -104,6 +146,12 @@ public:
     }
     ~HeirarZBuffer() = default;
 
+    void reset() { HZB->reset(); }
+    void update(int xMin, int yMin, int xMax, int yMax) // inclusive pixel bounds, on screen
+    {
+        HZB->update(zBufferData, xMin, yMin, xMax, yMax);
+    }
+
     // utility functions
     bool tileInScreenTest(Sint2 bbpMin, Sint2 bbpMax)
     {
@@ -115,28 +163,16 @@ public:
         return true;
     }
 
-    bool tileVisibleTest(Uint idx, Uint idy, float bbMinZ)
+    // false if the rect is off screen, or (when activated) every pixel under it is nearer than bbMinZ
+    bool tileVisibleTest(Sint2 bbpMin, Sint2 bbpMax, float bbMinZ)
     {
-        // 层次化遍历mipmap
-        for (int i = HZB->mipMap.size() - 1; i >= 0; i--)
-        {
-            Uint2 bbMin, bbMax;
-            HZB->getMipMapBB(i, idx, idy, bbMin, bbMax);
-            for (int j = bbMin.y; j <= bbMax.y; j++)
-                for (int k = bbMin.x; k <= bbMax.x; k++)
-                {
-                    if (HZB->mipMap[i].data[j * HZB->mipMap[i].width + k] < bbMinZ)
-                        return true;
-                }
-        }
-    }
-
-    void findMinBBPixel(Sint2 bbMin, Sint2 bbMax, int &lvl, int &pixelX, int &pixelY)
-    {
-        // turn to unsigned int
-        Uint2 bbpMin = Uint2(Max2(0, bbMin.x), Max2(0, bbMin.y));
-        Uint2 bbpMax = Uint2(Min2(width - 1, bbMax.x), Min2(height - 1, bbMax.y));
-        HZB->findMinBBPixel(bbpMin, bbpMax, lvl, pixelX, pixelY);
+        if (!tileInScreenTest(bbpMin, bbpMax))
+            return false;
+        if (!activated)
+            return true;
+        int xMin = bbpMin.x < 0 ? 0 : bbpMin.x, xMax = bbpMax.x > width - 1 ? width - 1 : bbpMax.x;
+        int yMin = bbpMin.y < 0 ? 0 : bbpMin.y, yMax = bbpMax.y > height - 1 ? height - 1 : bbpMax.y;
+        return bbMinZ <= HZB->maxDepth(zBufferData, xMin, yMin, xMax, yMax); // depth test is LessEqual
     }
 };
 
@@ -146,15 +182,42 @@ public:
     int height, width;
     float *zBufferData{nullptr};
     float *colorBufferData{nullptr};
-    std::vector<Vertex> vertices;
-    std::vector<Face> faces;
-    std::unique_ptr<RasterBVH> bvh{nullptr};
+    /***
+     * Instance
+     *  One OBJ with its own BVH (bottom level), built once in object space,
+     *  its model matrix is applied through the MVP at draw time, so moving it only rebuilds the top level
+     */
+    struct Instance
+    {
+        OBJ *obj;
+        std::vector<Vertex> vertices; // object space
+        std::vector<Face> faces;
+        std::unique_ptr<RasterBVH> bvh{nullptr};
+        bool activated{true};
+        glm::mat4 model{1.0f}; // as of the last top level build
+        glm::mat4 mvp{1.0f};
+        NodeBitSet visibleLeaves; // leaves that passed the culling test this frame
+        NodeBitSet passOneLeaves; // leaves drawn in pass one
+    };
+    std::vector<std::unique_ptr<Instance>> instances;
+    InstanceBVH tlas; // over the activated instances
+    RasterBVHContext context; // culling stats summed over the instances
     std::unique_ptr<EzHeirarZBuffer> tileManager{nullptr};
     std::unique_ptr<HeirarZBuffer> HZB{nullptr};
-    glm::mat4 mvp;
+    glm::mat4 mvp; // of the instance being drawn
     Camera &camera;
+    DirtyTileSet dirtyTiles; // tiles written since the last init(), only these are cleared
+    TiledLayout layout;      // always row-major, the pyramid and the present pass read the buffers directly
+    Pipeline<NormalVertexShader, NormalColorFragmentShader, Varyings<3>, DepthTest::LessEqual> pipeline;
+    // two pass occlusion: the leaves visible last frame are drawn first, then the BVH is traversed and culled against them
+    bool use_two_pass{true};
+    Uint passOneFaces{0};
+    bool use_front_to_back{true}; // instances and BVH children nearest first
+    bool use_frustum_culling{true}; // drop nodes outside the view frustum before their screen rect is tested
+    bool use_triangle_test{true}; // test each triangle of a visible leaf against the pyramid before drawing it
+    Uint culledTriangles{0};      // by that test, this frame
 
-    HeirarZBufferHelper(int width, int height, Camera &cam) : width(width), height(height), camera(cam)
+    HeirarZBufferHelper(int width, int height, Camera &cam) : width(width), height(height), camera(cam), dirtyTiles(width, height), layout(width, height)
     {
         zBufferData = new float[width * height];
         colorBufferData = new float[width * height * 3];
@@ -169,15 +232,33 @@ public:
 
     void init(Camera &camera)
     {
-        std::fill(zBufferData, zBufferData + width * height, std::numeric_limits<float>::infinity());
-        std::fill(colorBufferData, colorBufferData + width * height * 3, 0.0f);
-        mvp = camera.getViewProjectionMatrix(); // model matrix is not available
-        bvh->implementTransform(mvp);
+        dirtyTiles.clear(zBufferData, 1, std::numeric_limits<float>::infinity());
+        dirtyTiles.clear(colorBufferData, 3, 0.0f);
+        dirtyTiles.reset();
+        if (tlasDirty)
+            __buildTLAS();
+        viewProjection = camera.getViewProjectionMatrix();
+        for (auto &instance : instances)
+        {
+            if (!instance->activated)
+                continue;
+            instance->mvp = viewProjection * instance->model;
+            instance->bvh->implementTransform(instance->mvp);
+        }
     }
     void prepareVertex(OBJ &obj)
     {
         __vertexShader(obj);
     }
+    // call before init() every frame, a changed model matrix or activation rebuilds the top level only
+    void updateInstance(int index, bool activated)
+    {
+        auto &instance = *instances[index];
+        if (instance.activated == activated && instance.model == instance.obj->getModelMatrix())
+            return;
+        instance.activated = activated;
+        tlasDirty = true;
+    }
     void buildBVH()
     {
         __buildBVH();
@@ -190,129 +271,190 @@ public:
 private:
     void __vertexShader(OBJ &obj)
     {
-        // from world space to screen space
-        auto &faces_ = obj.getFaces();
-        auto &vertices_ = obj.getVertices();
-        for (auto &v : vertices_)
-            vertices.push_back(v);
-        // build triangles
-        for (int face_index = 0; face_index < faces_.size(); face_index++)
-        {
-            auto &face = faces_[face_index];
-            Face newFace;
-            newFace.v0 = face.v0 + obj_vertex_offset;
-            newFace.v1 = face.v1 + obj_vertex_offset;
-            newFace.v2 = face.v2 + obj_vertex_offset;
-            faces.push_back(newFace);
-        }
-        obj_vertex_offset += vertices_.size();
+        // vertices stay in object space, the model matrix is part of the instance's MVP
+        auto instance = std::make_unique<Instance>();
+        instance->obj = &obj;
+        instance->vertices = obj.getVertices();
+        instance->faces = obj.getFaces();
+        instances.push_back(std::move(instance));
     }
     void __buildBVH()
     {
-        bvh = std::make_unique<RasterBVH>(faces, vertices, 0.01, 0.020);
-        // set debug and render callback
-        BVHDebugCallBack debug = [this](BoundingBox3f bb) -> bool
+        for (auto &instance : instances)
         {
-            __drawBoundingBoxFrame(bb);
-            return true;
-        };
-        bvh->_traversalDebug = debug;
-        BVHRenderCallBack render = [this](BVHBuildNode *node, RasterBVHContext &context) -> bool
+            // arena sized for about two nodes per face
+            Uint memorySize = 1 + instance->faces.size() * 2 * sizeof(BVHBuildNode) / (1024 * 1024);
+            instance->bvh = std::make_unique<RasterBVH>(instance->faces, instance->vertices, 0.01, 0.020, RasterBVH::SplitMethod::Middle, memorySize);
+            Instance *current = instance.get();
+            // set debug and render callback
+            BVHDebugCallBack debug = [this](BoundingBox3f bb) -> bool
+            {
+                __drawBoundingBoxFrame(bb);
+                return true;
+            };
+            instance->bvh->_traversalDebug = debug;
+            BVHRenderCallBack render = [this, current](BVHBuildNode *node, RasterBVHContext &context) -> bool
+            {
+                drawing = current;
+                mvp = current->mvp;
+                return __visitNode(*node, context);
+            };
+            instance->bvh->_traversalRenderCallback = render; // for traversalBVH(), drawing uses the inlined traverse()
+            instance->visibleLeaves.resize(instance->bvh->_totalNodes);
+            instance->passOneLeaves.resize(instance->bvh->_totalNodes);
+        }
+        tlasDirty = true;
+    }
+    void __buildTLAS()
+    {
+        std::vector<BoundingBox3f> bounds(instances.size());
+        std::vector<int> activated;
+        for (int i = 0; i < instances.size(); i++)
         {
-            if (node->splitAxis != 3) // internal node
-                return __drawBoundingBoxInter(*node, context);
-            return __drawBoundingBoxLeaf(*node, context); // leaf node
-        };
-        bvh->_traversalRenderCallback = render;
+            auto &instance = *instances[i];
+            instance.model = instance.obj->getModelMatrix();
+            if (!instance.activated)
+                continue;
+            // world bounds of the object space root box
+            auto &b = instance.bvh->_root->bounds;
+            for (int c = 0; c < 8; c++)
+            {
+                glm::vec4 v = instance.model * glm::vec4(c & 1 ? b.pMax.x : b.pMin.x, c & 2 ? b.pMax.y : b.pMin.y, c & 4 ? b.pMax.z : b.pMin.z, 1.0f);
+                bounds[i] = Union(bounds[i], Point3f(v.x, v.y, v.z));
+            }
+            activated.push_back(i);
+        }
+        tlas.build(bounds, activated);
+        tlasDirty = false;
     }
     void __fragmentShader()
     {
         tileManager->resetMaxZ();
-        bvh->traversalBVH();
+        HZB->reset();
+        context.culledNodes = context.culledFaces = 0;
+        context.totalNodes = context.totalFaces = 0;
+        passOneFaces = 0;
+        culledTriangles = 0;
+        for (auto &instance : instances)
+        {
+            instance->passOneLeaves.swap(instance->visibleLeaves); // last frame's visible leaves
+            instance->visibleLeaves.clear();
+            if (!instance->activated)
+                continue;
+            context.totalNodes += instance->bvh->_totalNodes;
+            context.totalFaces += instance->faces.size();
+            instance->bvh->_context.culledNodes = instance->bvh->_totalNodes; // until traversed
+            instance->bvh->_context.culledFaces = instance->faces.size();
+            if (!use_two_pass)
+                continue;
+            // pass one: draw them untested, so the traversal tests against an almost complete depth buffer
+            drawing = instance.get();
+            mvp = instance->mvp;
+            Uint faces = 0;
+            instance->passOneLeaves.forEach([this, &faces](Uint nodeIndex)
+                                            { faces += __drawLeaf(*drawing->bvh->_nodes[nodeIndex]); });
+            passOneFaces += faces;
+        }
+        // pass two, instances nearest first
+        tlas.traverse(BoxProjector(viewProjection), use_front_to_back, use_frustum_culling, [this](const InstanceBVH::Node &node, const ProjectedBounds &projected)
+                      {
+            Sint2 bbMin, bbMax;
+            __toScreenRect(projected, bbMin, bbMax);
+            if (!HZB->tileVisibleTest(bbMin, bbMax, projected.zMin))
+                return false;
+            if (node.instance >= 0)
+                __traverseInstance(*instances[node.instance]);
+            return true; });
+        for (auto &instance : instances)
+        {
+            if (!instance->activated)
+                continue;
+            context.culledNodes += instance->bvh->_context.culledNodes;
+            context.culledFaces += instance->bvh->_context.culledFaces;
+        }
+        context.culledFaces -= passOneFaces;
     }
-    bool __drawBoundingBoxLeaf(BVHBuildNode &node, RasterBVHContext &context)
+    void __traverseInstance(Instance &instance)
     {
-        Uint needTileFromX{0}, needTileToX{tileManager->tileCountX}, needTileFromY{0}, needTileToY{tileManager->tileCountY};
-        bool need_draw = false;
-        std::vector<Uint> tileMaxZUpdateList;
-        glm::mat4 mat = mvp;
-        auto &bb = node.bounds;
-
-        float newBBxMin = bb.pMinNew.x, newBBxMax = bb.pMaxNew.x;
-        float newBByMin = bb.pMinNew.y, newBByMax = bb.pMaxNew.y;
-        float bbminZ = bb.pMinNew.z;
+        drawing = &instance;
+        mvp = instance.mvp;
+        instance.bvh->_frontToBack = use_front_to_back;
+        instance.bvh->_frustumCulling = use_frustum_culling;
+        instance.bvh->traverse([this](BVHBuildNode *node, RasterBVHContext &context)
+                               { return __visitNode(*node, context); });
+    }
+    void __toScreenRect(const ProjectedBounds &projected, Sint2 &bbMin, Sint2 &bbMax) const
+    {
+        float newBBxMin = projected.xMin, newBBxMax = projected.xMax;
+        float newBByMin = projected.yMin, newBByMax = projected.yMax;
         // to screen space
         newBBxMin = (newBBxMin + 1.0f) * width / 2.0f;
         newBBxMax = (newBBxMax + 1.0f) * width / 2.0f;
         newBByMin = (newBByMin + 1.0f) * height / 2.0f;
         newBByMax = (newBByMax + 1.0f) * height / 2.0f;
-        Sint2 newBBMin = Sint2(std::floor(newBBxMin), std::floor(newBByMin));
-        Sint2 newBBMax = Sint2(std::ceil(newBBxMax), std::ceil(newBByMax));
-        for (int i = needTileFromX; i < needTileToX; i++)
-            for (int j = needTileFromY; j < needTileToY; j++)
-                if (tileManager->ifTileNeedRender(newBBMin, newBBMax, i, j, bbminZ))
-                {
-                    tileMaxZUpdateList.push_back(i);
-                    tileMaxZUpdateList.push_back(j);
-                    need_draw = true;
-                }
+        bbMin = Sint2(std::floor(newBBxMin), std::floor(newBByMin));
+        bbMax = Sint2(std::ceil(newBBxMax), std::ceil(newBByMax));
+    }
+    // pixel rect and nearest depth of a node, from its projection (traverse() has projected it)
+    void __screenRect(const BVHBuildNode &node, Sint2 &bbMin, Sint2 &bbMax, float &bbMinZ) const
+    {
+        auto &proj = drawing->bvh->_projections;
+        Uint id = node.nodeIndex;
+        __toScreenRect({proj.xMin[id], proj.yMin[id], proj.xMax[id], proj.yMax[id], proj.zMin[id]}, bbMin, bbMax);
+        bbMinZ = proj.zMin[id];
+    }
+    bool __visitNode(BVHBuildNode &node, RasterBVHContext &context)
+    {
+        if (node.splitAxis != 3) // internal node
+            return __drawBoundingBoxInter(node, context);
+        return __drawBoundingBoxLeaf(node, context); // leaf node
+    }
+    bool __drawBoundingBoxLeaf(BVHBuildNode &node, RasterBVHContext &context)
+    {
+        Uint needTileFromX, needTileToX, needTileFromY, needTileToY; // inclusive
+        bool need_draw = false;
+        Sint2 newBBMin, newBBMax;
+        float bbminZ;
+        __screenRect(node, newBBMin, newBBMax, bbminZ);
+        if (!tileManager->tileRange(newBBMin, newBBMax, needTileFromX, needTileFromY, needTileToX, needTileToY))
+            return false;
+        for (Uint j = needTileFromY; j <= needTileToY && !need_draw; j++)
+            for (Uint i = needTileFromX; i <= needTileToX && !need_draw; i++)
+                need_draw = tileManager->ifTileNeedRender(i, j, bbminZ);
         if (!need_draw)
             return false;
+        drawing->visibleLeaves.set(node.nodeIndex);
+        if (use_two_pass && drawing->passOneLeaves.test(node.nodeIndex)) // drawn in pass one
+            return true;
+        context.culledFaces -= __drawLeaf(node);
+        return true;
+    }
+    Uint __drawLeaf(BVHBuildNode &node) // returns the number of faces drawn
+    {
         std::vector<Uint> face_render_list;
-        std::vector<Uint> &orderdata = bvh->orderedData;
+        std::vector<Uint> &orderdata = drawing->bvh->orderedData;
         for (int i = node.firstPrimOffset; i < node.firstPrimOffset + node.nPrimitives; i++)
         {
             Uint faceIndex = orderdata[i];
             face_render_list.push_back(faceIndex);
         }
+        drawnMin = Sint2(width, height), drawnMax = Sint2(-1, -1);
         for (int i = 0; i < face_render_list.size(); i++)
         {
-            auto &face = faces[face_render_list[i]];
+            auto &face = drawing->faces[face_render_list[i]];
             __drawTriangle(face);
         }
-        for (int i = 0; i < tileMaxZUpdateList.size(); i += 2)
-        {
-            tileManager->updateTileMaxZ(tileMaxZUpdateList[i], tileMaxZUpdateList[i + 1]);
-        }
-        context.culledFaces -= face_render_list.size();
-        return true;
+        if (drawnMin.x <= drawnMax.x)
+            HZB->update(drawnMin.x, drawnMin.y, drawnMax.x, drawnMax.y);
+        tileManager->updateStaleTiles();
+        return face_render_list.size();
     }
     bool __drawBoundingBoxInter(BVHBuildNode &node, RasterBVHContext &context)
     {
-        auto &bb = node.bounds;
-        Uint needTileFromX{0}, needTileToX{tileManager->tileCountX}, needTileFromY{0}, needTileToY{tileManager->tileCountY}; // 需要绘制的范围
-        bool need_draw = false;
-
-        float newBBxMin = bb.pMinNew.x, newBBxMax = bb.pMaxNew.x;
-        float newBByMin = bb.pMinNew.y, newBByMax = bb.pMaxNew.y;
-        float bbminZ = bb.pMinNew.z;
-        // to screen space
-        newBBxMin = (newBBxMin + 1.0f) * width / 2.0f;
-        newBBxMax = (newBBxMax + 1.0f) * width / 2.0f;
-        newBByMin = (newBByMin + 1.0f) * height / 2.0f;
-        newBByMax = (newBByMax + 1.0f) * height / 2.0f;
-        Sint2 newBBMin = Sint2(std::floor(newBBxMin), std::floor(newBByMin));
-        Sint2 newBBMax = Sint2(std::ceil(newBBxMax), std::ceil(newBByMax));
-        for (int i = needTileFromX; i < needTileToX; i++)
-        {
-            for (int j = needTileFromY; j < needTileToY; j++)
-            {
-                if (tileManager->ifTileNeedRender(newBBMin, newBBMax, i, j, bbminZ))
-                {
-                    need_draw = true;
-                    break;
-                }
-            }
-            if (need_draw)
-                break;
-        }
-        // new version
-        // int lvl, pixelX, pixelY;
-        // HZB->findMinBBPixel(newBBMin, newBBMax, lvl, pixelX, pixelY);
-        // std::cout << "for NewBBMin: " << newBBMin.x << " " << newBBMin.y << " NewBBMax: " << newBBMax.x << " " << newBBMax.y << std::endl;
-        // std::cout << "lvl: " << lvl << " pixelX: " << pixelX << " pixelY: " << pixelY << std::endl;
-
-        return need_draw;
+        Sint2 newBBMin, newBBMax;
+        float bbminZ;
+        __screenRect(node, newBBMin, newBBMax, bbminZ);
+        return HZB->tileVisibleTest(newBBMin, newBBMax, bbminZ);
     }
     void __drawBoundingBoxFrame(BoundingBox3f &bb)
     {
@@ -370,6 +512,7 @@ private:
         {
             if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
             {
+                dirtyTiles.markPixel(x0, y0);
                 textureMap[(y0 * width + x0) * 3] = r;
                 textureMap[(y0 * width + x0) * 3 + 1] = g;
                 textureMap[(y0 * width + x0) * 3 + 2] = b;
@@ -391,9 +534,9 @@ private:
     }
     void __drawTriangle(const Face &face)
     {
-        auto &v0_ = vertices[face.v0];
-        auto &v1_ = vertices[face.v1];
-        auto &v2_ = vertices[face.v2];
+        auto &v0_ = drawing->vertices[face.v0];
+        auto &v1_ = drawing->vertices[face.v1];
+        auto &v2_ = drawing->vertices[face.v2];
         auto v0Screen = glm::vec4(v0_.x, v0_.y, v0_.z, 1.0f);
         auto v1Screen = glm::vec4(v1_.x, v1_.y, v1_.z, 1.0f);
         auto v2Screen = glm::vec4(v2_.x, v2_.y, v2_.z, 1.0f);
@@ -422,41 +565,27 @@ private:
         Vertex tmpV0(v0Screen.x, v0Screen.y, v0Screen.z, v0_.nx, v0_.ny, v0_.nz);
         Vertex tmpV1(v1Screen.x, v1Screen.y, v1Screen.z, v1_.nx, v1_.ny, v1_.nz);
         Vertex tmpV2(v2Screen.x, v2Screen.y, v2Screen.z, v2_.nx, v2_.ny, v2_.nz);
-        for (int i = xMin < 0 ? 0 : xMin; i <= xMax && i < width; i++)
-            for (int j = yMin < 0 ? 0 : yMin; j <= yMax && j < height; j++)
-            {
-                float lambda1, lambda2, lambda3;
-                __ComputeBarycentricCoords(i, j, tmpV0, tmpV1, tmpV2, lambda2, lambda3);
-                lambda1 = 1 - lambda2 - lambda3;
-                if (__ifLambda12InsideTriangle(lambda1, lambda2))
-                {
-                    // draw fragment
-                    float z = lambda1 * tmpV0.z + lambda2 * tmpV1.z + (1 - lambda1 - lambda2) * tmpV2.z;
-                    if (z <= zBufferData[j * width + i])
-                    {
-                        float r = lambda1 * v0_.nx + lambda2 * v1_.nx + (1 - lambda1 - lambda2) * v2_.nx;
-                        float g = lambda1 * v0_.ny + lambda2 * v1_.ny + (1 - lambda1 - lambda2) * v2_.ny;
-                        float b = lambda1 * v0_.nz + lambda2 * v1_.nz + (1 - lambda1 - lambda2) * v2_.nz;
-                        zBufferData[j * width + i] = z;
-                        colorBufferData[(j * width + i) * 3] = r;
-                        colorBufferData[(j * width + i) * 3 + 1] = g;
-                        colorBufferData[(j * width + i) * 3 + 2] = b;
-                    }
-                }
-            }
-    }
-    void __ComputeBarycentricCoords(int x, int y, const Vertex &v0, const Vertex &v1, const Vertex &v2, float &lambda1, float &lambda2)
-    {
-        // barycentric coordinate
-        float area = 0.5f * (-v1.y * v2.x + v0.y * (-v1.x + v2.x) + v0.x * (v1.y - v2.y) + v1.x * v2.y);
-        lambda1 = 1 / (2 * area) * (v0.y * v2.x - v0.x * v2.y + (v2.y - v0.y) * x + (v0.x - v2.x) * y);
-        lambda2 = 1 / (2 * area) * (v0.x * v1.y - v0.y * v1.x + (v0.y - v1.y) * x + (v1.x - v0.x) * y);
-    }
-    bool __ifLambda12InsideTriangle(float l1, float l2)
-    {
-        return l1 >= 0 && l2 >= 0 && 1 - l1 - l2 >= 0;
-    }
-    int obj_vertex_offset{0}; // for each obj, the offset of vertices
+        int xStart = xMin < 0 ? 0 : xMin, xEnd = xMax < width - 1 ? xMax : width - 1;
+        int yStart = yMin < 0 ? 0 : yMin, yEnd = yMax < height - 1 ? yMax : height - 1;
+        if (xStart > xEnd || yStart > yEnd)
+            return;
+        float minZ = std::min(std::min(v0Screen.z, v1Screen.z), v2Screen.z);
+        // the pyramid is as of the end of the previous leaf, so this is conservative
+        if (use_triangle_test && !HZB->tileVisibleTest(Sint2(xStart, yStart), Sint2(xEnd, yEnd), minZ))
+        {
+            culledTriangles++;
+            return;
+        }
+        dirtyTiles.markRect(xStart, yStart, xEnd, yEnd);
+        tileManager->markWritten(xStart, yStart, xEnd, yEnd, minZ);
+        drawnMin = Sint2(std::min(drawnMin.x, xStart), std::min(drawnMin.y, yStart));
+        drawnMax = Sint2(std::max(drawnMax.x, xEnd), std::max(drawnMax.y, yEnd));
+        pipeline.drawTriangle(tmpV0, tmpV1, tmpV2, xStart, xEnd, yStart, yEnd, zBufferData, colorBufferData, layout);
+    }
+    Instance *drawing{nullptr}; // the instance being traversed or drawn
+    glm::mat4 viewProjection{1.0f};
+    bool tlasDirty{true};
+    Sint2 drawnMin, drawnMax; // pixels the current leaf's triangles may have written, for the pyramid update
 };
 
 class HeirarZBufferRaster : public Rasterizer
@@ -473,6 +602,8 @@ public:
     void render() override
     {
         _autoRotateCamera();
+        for (int i = 0; i < scene->objs.size(); i++)
+            zbuffer->updateInstance(i, scene->obj_activated[i]);
         zbuffer->init(scene->getCameraV()); // init zbuffer and implement transform to BVH
         zbuffer->drawFragment();
         __putColorBuffer2TextureMap();
@@ -482,8 +613,7 @@ public:
     int renderInit() override
     {
         for (int i = 0; i < scene->objs.size(); i++)
-            // if (scene->obj_activated[i])
-            zbuffer->prepareVertex(*scene->objs[i]);
+            zbuffer->prepareVertex(*scene->objs[i]); // activation is checked every frame
         zbuffer->buildBVH(); // build BVH
 
         return 1;
@@ -513,17 +643,36 @@ private:
     void __showHZBufferDataStructInfo()
     {
         _showimguiSubTitle("Heirarchical Z-Buffer Info");
-        ImGui::Text("Split Method: %s", RasterBVH::SplitMethodToString(zbuffer->bvh->_method).c_str());
-        ImGui::Text("Vertex Count: %d", zbuffer->vertices.size());
-        ImGui::Text("Face Count: %d", zbuffer->faces.size());
-        ImGui::Text("BVH Total Nodes: %d", zbuffer->bvh->_totalNodes);
-        ImGui::Text("BVH Depth: %d", zbuffer->bvh->_maxDepth);
+        int vertexCount = 0, faceCount = 0, totalNodes = 0, maxDepth = 0;
+        for (auto &instance : zbuffer->instances)
+        {
+            vertexCount += instance->vertices.size();
+            faceCount += instance->faces.size();
+            totalNodes += instance->bvh->_totalNodes;
+            maxDepth = std::max(maxDepth, instance->bvh->_maxDepth);
+        }
+        if (!zbuffer->instances.empty())
+            ImGui::Text("Split Method: %s", RasterBVH::SplitMethodToString(zbuffer->instances[0]->bvh->_method).c_str());
+        ImGui::Text("Vertex Count: %d", vertexCount);
+        ImGui::Text("Face Count: %d", faceCount);
+        ImGui::Text("BVH Total Nodes: %d (%d instances, top level %d nodes)", totalNodes, (int)zbuffer->instances.size(), (int)zbuffer->tlas.nodes.size());
+        ImGui::Text("BVH Depth: %d", maxDepth);
         ImGui::Separator();
-        ImGui::Checkbox("H-Z-Buffer Activated", &zbuffer->tileManager->activated);
+        if (ImGui::Checkbox("H-Z-Buffer Activated", &zbuffer->tileManager->activated))
+            zbuffer->HZB->activated = zbuffer->tileManager->activated;
         if (!zbuffer->tileManager->activated)
             ImGui::Text("Only use Screen Space Face Culling");
+        ImGui::Checkbox("Front To Back Traversal", &zbuffer->use_front_to_back);
+        ImGui::Checkbox("Two Pass Occlusion", &zbuffer->use_two_pass);
+        if (zbuffer->use_two_pass)
+            ImGui::Text("Pass One Faces: %8d", zbuffer->passOneFaces);
+        ImGui::Checkbox("Frustum Culling", &zbuffer->use_frustum_culling);
+        ImGui::Checkbox("Per Triangle Test", &zbuffer->use_triangle_test);
+        if (zbuffer->use_triangle_test)
+            ImGui::Text("Culled Triangles In Visible Leaves: %8d", zbuffer->culledTriangles);
         ImGui::Separator();
-        ImGui::Text("Culled Nodes: %8d  ratio(%2.1f%%)", zbuffer->bvh->_context.culledNodes, zbuffer->bvh->_context.culledNodes * 100.0f / zbuffer->bvh->_totalNodes);
-        ImGui::Text("Culled Faces: %8d  ratio(%2.1f%%)", zbuffer->bvh->_context.culledFaces, zbuffer->bvh->_context.culledFaces * 100.0f / zbuffer->faces.size());
+        auto &context = zbuffer->context; // over the activated instances
+        ImGui::Text("Culled Nodes: %8d  ratio(%2.1f%%)", context.culledNodes, context.culledNodes * 100.0f / std::max(1u, context.totalNodes));
+        ImGui::Text("Culled Faces: %8d  ratio(%2.1f%%)", context.culledFaces, context.culledFaces * 100.0f / std::max(1u, context.totalFaces));
     }
 };
\ No newline at end of file
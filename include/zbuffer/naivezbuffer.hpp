@@ -1,9 +1,18 @@
 #pragma once
 #include <rasterizer/rasterizer.hpp>
+#include <core/base.hpp>
+#include <core/framebuffer.hpp>
+#include <core/pipeline.hpp>
 
 class NaiveZBuffer // Naive Z-Buffer Rasterizer
 {
 public:
+    enum class ShadingMode // each mode draws with its own specialized Pipeline
+    {
+        NormalColor,
+        FlatColor,
+        DepthOnly,
+    };
     struct BoundingBox2D
     {
         int xMin, xMax, yMin, yMax;
@@ -12,6 +21,7 @@ public:
     {
         VertexIndex v0, v1, v2;
         BoundingBox2D bb;
+        bool isSmall{false}; // bounding box holds at most SmallTriangleExtent^2 pixel centers
         float calculateArea(const std::vector<Vertex> &vertices) const
         {
             auto &v0_ = vertices[v0];
@@ -23,11 +33,39 @@ public:
             return 0.5f * glm::length(cross);
         }
     };
+    struct RenderTarget // where a range of triangles is drawn to
+    {
+        float *zBuffer;
+        float *colorBuffer;
+        DirtyTileSet *dirtyTiles;
+    };
+    struct SortLastBuffer // private depth and color of one sort-last worker
+    {
+        std::vector<float> zBuffer;
+        std::vector<float> colorBuffer;
+        DirtyTileSet dirtyTiles;
+        SortLastBuffer(const TiledLayout &layout, int width, int height)
+            : zBuffer(layout.size(), std::numeric_limits<float>::infinity()), colorBuffer(layout.size() * 3, 0.0f), dirtyTiles(width, height) {}
+    };
     int height, width;
     float *zBufferData{nullptr};
     float *colorBufferData{nullptr};
     bool use_cull_face{true};
+    ShadingMode shading_mode{ShadingMode::NormalColor};
+    CullMode cull_mode{CullMode::None}; // face culling of the pipeline, counter-clockwise on screen is front
+    bool use_tiled_layout{false}; // 8x8 Morton tiles for depth and color, applied on next init()
     int culled_face{0};
+    TiledLayout layout;
+    DirtyTileSet dirtyTiles; // tiles written since the last init(), only these are cleared
+
+    static constexpr int SmallTriangleBatch = 8;  // tiny triangles rasterized together, one per SIMD lane
+    static constexpr int SmallTriangleExtent = 3; // candidate pixel centers per axis for a tiny triangle
+    bool use_small_triangle_path{true};
+    int small_triangle_count{0}; // triangles drawn by the batched path in the last frame
+    int large_triangle_count{0}; // triangles drawn by __drawTriangle in the last frame
+
+    bool use_sort_last{false}; // every worker draws a chunk of triangles into a private buffer, then depth composite
+    int sort_last_workers{1};  // workers used in the last sort-last frame
 
     std::vector<Vertex> vertices;
     std::vector<Face> faces;
@@ -43,17 +81,29 @@ public:
 private:
     void __vertexShader(OBJ &obj, Camera &camera);
     void __fragmentShader();
+    void __fragmentShaderSortLast();
+    void __compositeSortLast();
 
-    void __drawTriangle(const Triangle &triangle);
+    // f(pipeline) with the pipeline specialized for shading_mode and cull_mode
+    template <typename F>
+    void __withPipeline(F &&f) const;
+    template <CullMode Cull, typename F>
+    void __withPipelineCulled(F &&f) const;
+    void __drawTriangles(int begin, int end, const RenderTarget &target, int &smallCount, int &largeCount);
+    template <typename P>
+    void __drawTrianglesWith(const P &pipeline, int begin, int end, const RenderTarget &target, int &smallCount, int &largeCount);
+    template <typename P>
+    void __drawTriangle(const P &pipeline, const Triangle &triangle, const RenderTarget &target);
+    template <typename P>
+    void __drawSmallTriangles(const P &pipeline, const Triangle *const *batch, int count, const RenderTarget &target);
     void __drawTriangleFrame(const Triangle &triangle);
     void __drawTriangleBB(const Triangle &triangle);
 
     bool __ifTriangleInScreen(const Triangle &triangle);
-    static bool __ifLambda12InsideTriangle(float l1, float l2);
     void __drawLineScreenSpace(const glm::vec2 &p0, const glm::vec2 &p1, float r, float g, float b);
-    void __ComputeBarycentricCoords(int x, int y, const Triangle &triangle, float &lambda1, float &lambda2);
 
     int obj_vertex_offset{0}; // for each obj, the offset of vertices
+    std::vector<std::unique_ptr<SortLastBuffer>> sortLastBuffers; // worker 0 draws into zBufferData/colorBufferData directly
 };
 
 class NaiveZBufferRaster : public Rasterizer
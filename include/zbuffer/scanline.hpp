@@ -1,31 +1,51 @@
 #pragma once
 #include <rasterizer/rasterizer.hpp>
+#include <core/framebuffer.hpp>
 #include <cassert>
+#include <cstdint>
+#include <cmath>
 #include <fstream>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 class Scanline
 {
 public:
     int height, width;
-    struct Edge
+    /***
+     * EdgePool
+     *  Edges stored as structure of arrays, x and the normal (color) in fixed point
+     *  TotalEdgeTable keeps every edge of the frame at its first scanline, each worker copies the edges it activates
+     *  into its own active edge table (caught up to the current scanline) and steps them there, so there is no drift to resync
+     *  Depth is not stored per edge, spans take it from the polygon plane
+     */
+    struct EdgePool
     {
-        float xStart, xEnd, yMin; // xyz
-        float zStart, zEnd, yMax;
-        float xSlope, zSlope;
-        float rStart, gStart, bStart; // rgb
-        float rEnd, gEnd, bEnd;
-        float rSlope, gSlope, bSlope;
-
-        Edge(Vertex v0, Vertex v1, int eId);
-        bool if_paired{false};
-        int eId, pId;
-
-        float xStartFixed, yStartFixed, zStartFixed;
-        float rStartFixed, gStartFixed, bStartFixed;
-        void edgeStepToIntegerY(int integerY);
+        static constexpr int FixedShift = 16; // 16 fractional bits
+        static constexpr float FixedOne = 1 << FixedShift;
+
+        std::vector<int64_t> x, dx;     // screen x at the current scanline and its step per scanline
+        std::vector<int32_t> r, g, b;    // normal at the current scanline
+        std::vector<int32_t> dr, dg, db; // normal step per scanline
+        std::vector<int> yStart, yEnd;   // first scanline the edge covers, and the first one it no longer covers
+
+        int size() const { return x.size(); }
+        void clear();
+        void resize(int n);
+        int push(const Vertex &v0, const Vertex &v1, int y, int yEnd); // v0.y < v1.y, values start at scanline y
+        void set(int slot, const EdgePool &from, int e, int y);        // edge e of from, stepped to scanline y, slot <= size()
+        void move(int to, int from);
+        void place(int offset, const EdgePool &from); // copy all of from to [offset, offset + from.size()), already sized
+        int64_t xAt(int e, int y) const { return x[e] + (int64_t)(y - yStart[e]) * dx[e]; }
+
+        static int64_t toFixed(double v) { return (int64_t)std::llround(v * FixedOne); }
+        static float toFloat(int64_t v) { return v / FixedOne; }
+        static int ceil(int64_t v) { return (int)((v + (1 << FixedShift) - 1) >> FixedShift); }
     };
 
-    struct Polygon
+    struct Polygon // convex, 3 or more vertices
     {
         std::vector<Vertex> vertices;
         float a, b, c, d;
@@ -33,35 +53,214 @@ public:
         int pid;
     };
 
-    using EdgeTable = std::vector<Edge>;
-    using EdgeIdTable = std::vector<int>;
+    // depth plane of a polygon, z(x, y) = z0 + (x - x0) * zDx + (y - y0) * zDy, with zDx = -a / c, zDy = -b / c
+    struct PolygonDepth
+    {
+        float x0, y0, z0;
+        float zDx, zDy;
+
+        float at(float x, float y) const { return z0 + (x - x0) * zDx + (y - y0) * zDy; }
+    };
+
+    // a polygon crossing the current scanline, its left and right edges are at 2k and 2k + 1 in the active edge table
+    struct ActivePolygon
+    {
+        int pId;
+        int nextEdge, edgeEnd; // the polygon's edges not used yet, in TotalEdgeTable
+    };
+
+    // a span of active polygon k starts (enter) or ends at pixel x
+    struct IntervalEvent
+    {
+        int x;
+        int k;
+        bool enter;
+    };
+
+    // the normal along a span, n(x) = n0 + (x - x0) * dn
+    struct SpanShading
+    {
+        float x0;
+        float r, g, b;
+        float dr, dg, db;
+    };
+
+    /***
+     * ScanContext
+     *  What one worker needs to scan a band of rows on its own: the active polygons, a private copy of their edges
+     *  at the current scanline, and the tiles its spans touched
+     */
+    struct ScanContext
+    {
+        EdgePool activeEdgeTable; // left and right edge of active polygon k at 2k and 2k + 1
+        std::vector<ActivePolygon> activePolygonTable;
+        DirtyTileSet dirtyTiles;
+        float edgeCount{0.0f};
+        // interval mode, reused every scanline
+        std::vector<IntervalEvent> events;
+        std::vector<int> covering; // active polygons covering the current interval
+        std::vector<SpanShading> spans;
+        int intervalCount{0};
+        std::vector<float> rowDepth; // depth of the current scanline, when use_row_depth
+        // span rejection, the max depth of each segment of the current scanline
+        std::vector<float> segmentMaxDepth;
+        std::vector<Uchar> segmentStale; // written since segmentMaxDepth was computed
+        long long spanPixels{0}, skippedPixels{0};
+
+        ScanContext(int width, int height) : dirtyTiles(width, height) { dirtyTiles.reset(); }
+    };
+
+    /***
+     * BucketTable
+     *  Items grouped by bucket in two flat arrays (CSR), the items of bucket b are ids[begin[b]] .. ids[begin[b + 1] - 1]
+     *  Built by a counting sort in parallel over the items (per worker counts, then a prefix sum),
+     *  items keep their order inside a bucket, and the storage is reused from frame to frame
+     */
+    struct BucketTable
+    {
+        std::vector<int> begin, ids;
+
+        // bucketsOf(item, add) calls add(bucket) for every bucket the item goes to
+        template <typename F>
+        void build(int bucketCount, int itemCount, F &&bucketsOf);
+        int size(int b) const { return begin[b + 1] - begin[b]; }
+        const int *operator[](int b) const { return ids.data() + begin[b]; }
+
+    private:
+        std::vector<int> counts; // per worker, per bucket
+    };
+
+    /***
+     * ScanMode
+     *  ZBuffer: spans are filled pixel by pixel with a depth test
+     *  Interval: the span ends split each scanline into intervals covered by a fixed set of polygons,
+     *  the visible polygon of an interval is found from the plane depths at its two ends (splitting where depths cross)
+     *  and written as a run, no depth buffer is used
+     */
+    enum class ScanMode
+    {
+        ZBuffer,
+        Interval,
+    };
+    ScanMode scan_mode{ScanMode::ZBuffer};
+    bool use_row_depth{true}; // z-buffer mode keeps depth for one scanline per worker instead of the whole frame
+    // z-buffer mode skips the pieces of a span that are behind every pixel of their row segment
+    static constexpr int SegmentShift = 4; // 16 pixels per segment
+    bool use_span_rejection{true};
+
+    static constexpr int BandHeight = 2 * TiledLayout::TileSize; // rows per band, bands are scheduled dynamically
+    bool use_band_parallel{true};
+    int band_workers{1};
 
     int obj_vertex_offset{0}; // for each obj, the offset of vertices
-    int obj_face_offset{0};   // for each obj, the offset of vertices
+    int obj_face_offset{0};   // for each obj, the offset of polygons
     std::vector<Vertex> vertices;
-    EdgeTable TotalEdgeTable;
-    EdgeTable activeEdgeTable;
-    std::vector<EdgeIdTable> activeTable;   // for each scanline, the edges to be added to the active edge table
-    std::vector<EdgeIdTable> deactiveTable; // for each scanline, the edges to be deleted from the active edge table
+    EdgePool TotalEdgeTable;
+    std::vector<PolygonDepth> polygonDepths;      // indexed by pid
+    std::vector<int> polygonEdgeBegin;            // the edges of polygon pid are [polygonEdgeBegin[pid], polygonEdgeBegin[pid + 1]), by first scanline
+    std::vector<int> polygonYStart, polygonYEnd;  // first scanline of polygon pid, and the first one it no longer covers
+    BucketTable polygonTable;                     // for each scanline, the polygons starting on it
 
-    std::vector<float> zBuffer;
+    std::vector<float> zBuffer; // full frame depth, empty when use_row_depth
     float *zBufferData{nullptr};
+    DirtyTileSet dirtyTiles; // tiles touched by spans since the last init(), only these are cleared
 
     Scanline(int width, int height);
 
     void init();
     void buildTable(OBJ &obj, Camera &camera);
+    void buildTables(const std::vector<OBJ *> &objs, Camera &camera); // all objects at once, in parallel over their polygons
     void scanScreen();
 
     // for debug
-    float avgEdgeCount{0.0f};
+    float avgEdgeCount{0.0f};     // active polygons (edge pairs) per scanline
+    float avgIntervalCount{0.0f}; // visible runs per scanline, interval mode only
+    float skippedSpanPercent{0.0f}; // span pixels rejected by segment, z-buffer mode only
 
 private:
-    int edgeIdCounter{0};
-    void __buildActivateDeactivateTable(Polygon &polygon);
-    int __findNextSamePolyEdge(int pId);
+    struct PendingEdge
+    {
+        int i; // edge from vertex i to i + 1
+        int yStart, yEnd;
+    };
+    // what one worker builds from a run of polygons, merged into the tables afterwards
+    struct TableChunk
+    {
+        EdgePool edges;
+        std::vector<PolygonDepth> depths;
+        std::vector<int> yStart, yEnd;
+        std::vector<int> edgeEnd; // per polygon, the end of its edges in edges
+        std::vector<PendingEdge> pendingEdges;
+        Polygon polygon;
+        void clear();
+    };
+    std::vector<std::unique_ptr<TableChunk>> tableChunks; // one per worker
+    std::vector<std::unique_ptr<ScanContext>> scanContexts; // one per worker
+    BucketTable bandCrossings;                              // for each band, the polygons started above it and still active on its first row
+    void __buildPolygon(const OBJ &obj, int polygon_index, int vertexOffset, TableChunk &chunk);
+    bool __buildPolygonTable(Polygon &polygon, TableChunk &chunk); // false if the polygon covers no scanline
+    void __buildBuckets(int bandCount);
+    void __scanBand(ScanContext &context, int band, int yStart, int yEnd);
+    void __scanRowZBuffer(ScanContext &context, int y);
+    float __segmentMaxDepth(ScanContext &context, const float *depth, int segment) const;
+    void __scanRowIntervals(ScanContext &context, int y);
+    void __resolveInterval(ScanContext &context, int y, int xStart, int xEnd);
+    void __writeRun(ScanContext &context, int k, int y, int xStart, int xEnd);
+    SpanShading __spanShading(const EdgePool &active, int k) const;
+    static float __encodeNormal(float r, float g, float b);
+    void __activatePolygon(ScanContext &context, int pId, int y);
+    void __advanceActivePolygons(ScanContext &context, int y);
+    void __orderEdgePair(int &left, int &right, int y) const;
 };
 
+template <typename F>
+void Scanline::BucketTable::build(int bucketCount, int itemCount, F &&bucketsOf)
+{
+    int workers = 1;
+    begin.resize(bucketCount + 1);
+#pragma omp parallel
+    {
+        int w = 0;
+#ifdef _OPENMP
+        w = omp_get_thread_num();
+#endif
+#pragma omp single
+        {
+            // the team can be smaller than asked for, split the items over the threads that actually run
+#ifdef _OPENMP
+            workers = omp_get_num_threads();
+#endif
+            counts.assign((size_t)workers * bucketCount, 0);
+        }
+        int from = (long long)itemCount * w / workers, to = (long long)itemCount * (w + 1) / workers;
+        int *count = counts.data() + (size_t)w * bucketCount;
+        for (int item = from; item < to; item++)
+            bucketsOf(item, [count](int b)
+                      { count[b]++; });
+#pragma omp barrier
+#pragma omp single
+        {
+            // bucket by bucket, worker by worker, so a bucket lists its items in item order
+            int offset = 0;
+            for (int b = 0; b < bucketCount; b++)
+            {
+                begin[b] = offset;
+                for (int i = 0; i < workers; i++)
+                {
+                    int c = counts[(size_t)i * bucketCount + b];
+                    counts[(size_t)i * bucketCount + b] = offset;
+                    offset += c;
+                }
+            }
+            begin[bucketCount] = offset;
+            ids.resize(offset);
+        }
+        for (int item = from; item < to; item++)
+            bucketsOf(item, [this, count, item](int b)
+                      { ids[count[b]++] = item; });
+    }
+}
+
 class ScanlineRaster : public Rasterizer
 {
 public:
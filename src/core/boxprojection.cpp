@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <limits>
+
+#include <core/boxprojection.hpp>
+#ifdef __AVX__
+#include <immintrin.h>
+
+static float __horizontalMin(__m256 v)
+{
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static float __horizontalMax(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+// a clip space point per lane
+struct Lanes4
+{
+    __m256 x, y, z, w;
+};
+
+// ProjectedBounds per lane
+struct ProjectedLanes
+{
+    __m256 xMin{_mm256_set1_ps(std::numeric_limits<float>::infinity())}, yMin{xMin}, zMin{xMin};
+    __m256 xMax{_mm256_set1_ps(-std::numeric_limits<float>::infinity())}, yMax{xMax};
+};
+
+static inline Lanes4 __add(const Lanes4 &a, const Lanes4 &b)
+{
+    return {_mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z), _mm256_add_ps(a.w, b.w)};
+}
+
+static inline Lanes4 __scale(const glm::vec4 &column, __m256 s)
+{
+    return {_mm256_mul_ps(_mm256_set1_ps(column.x), s), _mm256_mul_ps(_mm256_set1_ps(column.y), s),
+            _mm256_mul_ps(_mm256_set1_ps(column.z), s), _mm256_mul_ps(_mm256_set1_ps(column.w), s)};
+}
+
+// divide a corner by w and widen the bounds with it
+static inline void __accumulate(ProjectedLanes &bounds, const Lanes4 &c)
+{
+    // true divides like the single box kernel, a reciprocal multiply could round zMin above its result
+    __m256 x = _mm256_div_ps(c.x, c.w), y = _mm256_div_ps(c.y, c.w), z = _mm256_div_ps(c.z, c.w);
+    bounds.xMin = _mm256_min_ps(bounds.xMin, x), bounds.xMax = _mm256_max_ps(bounds.xMax, x);
+    bounds.yMin = _mm256_min_ps(bounds.yMin, y), bounds.yMax = _mm256_max_ps(bounds.yMax, y);
+    bounds.zMin = _mm256_min_ps(bounds.zMin, z);
+}
+#endif
+
+BoxProjector::BoxProjector(const glm::mat4 &m) : m(m)
+{
+    // row i of m, a clip space coordinate is dot(row, (p, 1))
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    planes[Left] = row[3] + row[0];
+    planes[Right] = row[3] - row[0];
+    planes[Bottom] = row[3] + row[1];
+    planes[Top] = row[3] - row[1];
+    planes[Near] = row[3] + row[2];
+    planes[Far] = row[3] - row[2];
+}
+
+bool BoxProjector::frustumTest(const BoundingBox3f &box, int &planeMask) const
+{
+    for (int i = 0; i < PlaneCount; i++)
+    {
+        if (!(planeMask & (1 << i)))
+            continue;
+        const glm::vec4 &plane = planes[i];
+        // p-vertex: the corner furthest along the plane normal, n-vertex: the one furthest against it
+        float p = plane.w, n = plane.w;
+        p += plane.x * (plane.x > 0 ? box.pMax.x : box.pMin.x), n += plane.x * (plane.x > 0 ? box.pMin.x : box.pMax.x);
+        p += plane.y * (plane.y > 0 ? box.pMax.y : box.pMin.y), n += plane.y * (plane.y > 0 ? box.pMin.y : box.pMax.y);
+        p += plane.z * (plane.z > 0 ? box.pMax.z : box.pMin.z), n += plane.z * (plane.z > 0 ? box.pMin.z : box.pMax.z);
+        if (p < 0.0f) // every corner is outside
+            return false;
+        if (n >= 0.0f) // every corner is inside
+            planeMask &= ~(1 << i);
+    }
+    return true;
+}
+
+ProjectedBounds BoxProjector::unbounded()
+{
+    return {-1.0f, -1.0f, 1.0f, 1.0f, -std::numeric_limits<float>::infinity()};
+}
+
+ProjectedBounds BoxProjector::project(const BoundingBox3f &box) const
+{
+    // summed in the same order as the batched kernel, not left to glm's m * v
+    glm::vec4 base = (m[0] * box.pMin.x + m[1] * box.pMin.y) + (m[2] * box.pMin.z + m[3]);
+    Point3f d = box.Diagonal();
+    glm::vec4 ex = m[0] * d.x, ey = m[1] * d.y, ez = m[2] * d.z;
+    ProjectedBounds out;
+#ifdef __AVX__
+    // corner i takes the x extent if bit 0 of i is set, y for bit 1, z for bit 2
+    const __m256 sx = _mm256_setr_ps(0, 1, 0, 1, 0, 1, 0, 1);
+    const __m256 sy = _mm256_setr_ps(0, 0, 1, 1, 0, 0, 1, 1);
+    const __m256 sz = _mm256_setr_ps(0, 0, 0, 0, 1, 1, 1, 1);
+    __m256 c[4];
+    for (int k = 0; k < 4; k++)
+    {
+        __m256 v = _mm256_set1_ps(base[k]);
+        v = _mm256_add_ps(v, _mm256_mul_ps(sx, _mm256_set1_ps(ex[k])));
+        v = _mm256_add_ps(v, _mm256_mul_ps(sy, _mm256_set1_ps(ey[k])));
+        c[k] = _mm256_add_ps(v, _mm256_mul_ps(sz, _mm256_set1_ps(ez[k])));
+    }
+    __m256 x = _mm256_div_ps(c[0], c[3]), y = _mm256_div_ps(c[1], c[3]), z = _mm256_div_ps(c[2], c[3]);
+    out.xMin = __horizontalMin(x), out.xMax = __horizontalMax(x);
+    out.yMin = __horizontalMin(y), out.yMax = __horizontalMax(y);
+    out.zMin = __horizontalMin(z);
+#else
+    out.xMin = out.yMin = out.zMin = std::numeric_limits<float>::infinity();
+    out.xMax = out.yMax = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec4 v = base;
+        if (i & 1)
+            v = v + ex;
+        if (i & 2)
+            v = v + ey;
+        if (i & 4)
+            v = v + ez;
+        v /= v.w;
+        out.xMin = std::min(out.xMin, v.x), out.xMax = std::max(out.xMax, v.x);
+        out.yMin = std::min(out.yMin, v.y), out.yMax = std::max(out.yMax, v.y);
+        out.zMin = std::min(out.zMin, v.z);
+    }
+#endif
+    return out;
+}
+
+void BoxProjector::project(const BoundingBox3f *boxes, int count, ProjectedBounds *out) const
+{
+#ifdef __AVX__
+    // structure of arrays, one box per lane, 8 boxes per pass
+    for (int first = 0; first < count; first += 8)
+    {
+        int n = std::min(8, count - first);
+        alignas(32) float lo[3][8], hi[3][8];
+        for (int l = 0; l < 8; l++)
+        {
+            const BoundingBox3f &box = boxes[first + std::min(l, n - 1)]; // unused lanes repeat the last box
+            lo[0][l] = box.pMin.x, lo[1][l] = box.pMin.y, lo[2][l] = box.pMin.z;
+            hi[0][l] = box.pMax.x, hi[1][l] = box.pMax.y, hi[2][l] = box.pMax.z;
+        }
+        __m256 x = _mm256_load_ps(lo[0]), y = _mm256_load_ps(lo[1]), z = _mm256_load_ps(lo[2]);
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(hi[0]), x);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(hi[1]), y);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(hi[2]), z);
+        // the min corner in clip space, and how it changes along each extent
+        Lanes4 base = __add(__add(__scale(m[0], x), __scale(m[1], y)), __add(__scale(m[2], z), __scale(m[3], _mm256_set1_ps(1.0f))));
+        Lanes4 ex = __scale(m[0], dx), ey = __scale(m[1], dy), ez = __scale(m[2], dz);
+        ProjectedLanes bounds;
+        // extents added x, y, z in that order like the single box kernel, so both give the same corners bit for bit
+        Lanes4 c1 = __add(base, ex), c2 = __add(base, ey), c3 = __add(c1, ey);
+        __accumulate(bounds, base), __accumulate(bounds, c1), __accumulate(bounds, c2), __accumulate(bounds, c3);
+        __accumulate(bounds, __add(base, ez)), __accumulate(bounds, __add(c1, ez));
+        __accumulate(bounds, __add(c2, ez)), __accumulate(bounds, __add(c3, ez));
+        alignas(32) float result[5][8];
+        _mm256_store_ps(result[0], bounds.xMin), _mm256_store_ps(result[1], bounds.yMin);
+        _mm256_store_ps(result[2], bounds.xMax), _mm256_store_ps(result[3], bounds.yMax);
+        _mm256_store_ps(result[4], bounds.zMin);
+        for (int l = 0; l < n; l++)
+            out[first + l] = {result[0][l], result[1][l], result[2][l], result[3][l], result[4][l]};
+    }
+#else
+    for (int i = 0; i < count; i++)
+        out[i] = project(boxes[i]);
+#endif
+}
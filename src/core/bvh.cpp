@@ -1,24 +1,18 @@
 #include <iostream>
+#include <algorithm>
 
 #include <core/bvh.hpp>
 
 void RasterBVH::implementTransform(glm::mat4 &m)
 {
-    assert(_root != nullptr && "BVH root is nullptr");
-    if (_root == nullptr)
-        return;
-    __implementTransform(m, _root);
+    _projector = BoxProjector(m);
+    _frame++; // every projection is out of date
 }
 
 void RasterBVH::traversalBVH()
 {
-    assert(_root != nullptr && "BVH root is nullptr");
-    if (_root == nullptr)
-        return;
-
-    _context.culledNodes = _totalNodes;
-    _context.culledFaces = _context.totalFaces;
-    __traversalBVH(_root);
+    traverse([this](BVHBuildNode *node, RasterBVHContext &context)
+             { return _traversalRenderCallback(node, context); });
 }
 
 void RasterBVH::__initBVH()
@@ -44,7 +38,8 @@ BVHBuildNode *RasterBVH::__recursiveBuild(int start, int end)
     if (_depth > _maxDepth)
         _maxDepth = _depth;
     BVHBuildNode *node = _arena->Alloc<BVHBuildNode>();
-    _totalNodes++;
+    node->nodeIndex = _totalNodes++;
+    _nodes.push_back(node);
     float minX, minY, minZ, maxX, maxY, maxZ;
     minX = minY = minZ = std::numeric_limits<float>::infinity();
     maxX = maxY = maxZ = -std::numeric_limits<float>::infinity();
@@ -154,7 +149,8 @@ BVHBuildNode *RasterBVH::__recursiveBuildSAH(int start, int end)
     if (_depth > _maxDepth)
         _maxDepth = _depth;
     BVHBuildNode *node = _arena->Alloc<BVHBuildNode>();
-    _totalNodes++;
+    node->nodeIndex = _totalNodes++;
+    _nodes.push_back(node);
     float minX, minY, minZ, maxX, maxY, maxZ;
     minX = minY = minZ = std::numeric_limits<float>::infinity();
     maxX = maxY = maxZ = -std::numeric_limits<float>::infinity();
@@ -273,19 +269,6 @@ BVHBuildNode *RasterBVH::__recursiveBuildSAH(int start, int end)
     return node;
 }
 
-void RasterBVH::__traversalBVH(BVHBuildNode *node)
-{
-    // _traversalDebug(node->bounds);
-    if (!_traversalRenderCallback(node, _context)) // if the node is culled(only for internal nodes)
-        return;
-    _context.culledNodes--;
-    if (node->splitAxis != 3) // internal node
-    {
-        __traversalBVH(node->children[0]);
-        __traversalBVH(node->children[1]);
-    }
-}
-
 void RasterBVH::__printBVHInfo()
 {
     std::cout << "BVH Info: " << std::endl;
@@ -293,17 +276,59 @@ void RasterBVH::__printBVHInfo()
     std::cout << "Depth: " << _depth << std::endl;
 }
 
-void RasterBVH::__implementTransform(glm::mat4 &m, BVHBuildNode *node)
+bool RasterBVH::__enter(BVHBuildNode *node, int planeMask, TraversalEntry &entry)
 {
-    // calculate z value
-    if (node->splitAxis == 3)
-    {
-        node->bounds.implementTransform(m);
-    }
-    else
+    entry.node = node;
+    entry.planeMask = planeMask;
+    if (!_projector.frustumTest(node->bounds, entry.planeMask)) // no planes to test when _frustumCulling is off
+        return false;
+    __project(node, entry.planeMask);
+    return true;
+}
+
+void RasterBVH::__project(const BVHBuildNode *node, int planeMask)
+{
+    Uint id = node->nodeIndex;
+    if (_projections.frame[id] == _frame)
+        return;
+    _projections.frame[id] = _frame;
+    // corners behind the camera divide by a negative w, the rect they give is meaningless
+    ProjectedBounds p = planeMask & (1 << BoxProjector::Near) ? BoxProjector::unbounded() : _projector.project(node->bounds);
+    _projections.xMin[id] = p.xMin, _projections.xMax[id] = p.xMax;
+    _projections.yMin[id] = p.yMin, _projections.yMax[id] = p.yMax;
+    _projections.zMin[id] = p.zMin;
+}
+
+void InstanceBVH::build(const std::vector<BoundingBox3f> &bounds, const std::vector<int> &instances)
+{
+    nodes.clear();
+    if (instances.empty())
+        return;
+    std::vector<int> items = instances;
+    __build(items, 0, items.size(), bounds);
+}
+
+int InstanceBVH::__build(std::vector<int> &items, int begin, int end, const std::vector<BoundingBox3f> &bounds)
+{
+    int index = nodes.size();
+    nodes.emplace_back();
+    BoundingBox3f box;
+    for (int i = begin; i < end; i++)
+        box = Union(box, bounds[items[i]]);
+    nodes[index].bounds = box;
+    if (end - begin == 1)
     {
-        node->bounds.implementTransform(m);
-        __implementTransform(m, node->children[0]);
-        __implementTransform(m, node->children[1]);
+        nodes[index].children[0] = nodes[index].children[1] = -1;
+        nodes[index].instance = items[begin];
+        return index;
     }
+    int axis = box.MaximumExtent();
+    int mid = (begin + end) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&](int a, int b)
+                     { return bounds[a].pMin[axis] + bounds[a].pMax[axis] < bounds[b].pMin[axis] + bounds[b].pMax[axis]; });
+    int left = __build(items, begin, mid, bounds);
+    int right = __build(items, mid, end, bounds);
+    nodes[index].children[0] = left, nodes[index].children[1] = right; // nodes may have been reallocated
+    nodes[index].instance = -1;
+    return index;
 }
@@ -67,8 +67,7 @@ void OBJLoader::__parse()
             break;
         case 'f':
         {
-            Face f = __parseFace(line);
-            obj->addFace(f);
+            __parseFace(line);
         }
         break;
         default:
@@ -106,60 +105,79 @@ TexutreUV OBJLoader::__parseUV(const std::string &line)
     return TexutreUV(u, v);
 }
 
-Face OBJLoader::__parseFace(const std::string &line)
+void OBJLoader::__parseFace(const std::string &line)
 {
     std::stringstream ss(line);
     char c;
-    VertexIndex v1(-1), v2(-1), v3(-1);
-    TextureUVIndex uv1(-1), uv2(-1), uv3(-1);
-    NormalIndex n1(-1), n2(-1), n3(-1);
     ss >> c;
-    // v1//n1 or v1/vt1/vn1 or v1/vt1 or v1
-    ss >> v1;
-    if (ss.peek() == '/')
+    faceVertexIndices.clear(), faceUVIndices.clear(), faceNormalIndices.clear();
+    VertexIndex v;
+    // v//n or v/vt/vn or v/vt or v, as many as the face has
+    while (ss >> v)
     {
-        ss >> c;
-        if (ss.peek() != '/')
-        {
-            ss >> uv1;
-        }
+        TextureUVIndex uv(-1);
+        NormalIndex n(-1);
         if (ss.peek() == '/')
         {
             ss >> c;
-            ss >> n1;
+            if (ss.peek() != '/')
+            {
+                ss >> uv;
+            }
+            if (ss.peek() == '/')
+            {
+                ss >> c;
+                ss >> n;
+            }
         }
+        faceVertexIndices.push_back(v);
+        faceUVIndices.push_back(uv);
+        faceNormalIndices.push_back(n);
     }
-    // v2//n2 or v2/vt2/vn2 or v2/vt2 or v2
-    ss >> v2;
-    if (ss.peek() == '/')
+    auto &vi = faceVertexIndices, &ti = faceUVIndices, &ni = faceNormalIndices;
+    if (vi.size() < 3)
+        return;
+    // the triangle based rasterizers get a fan
+    for (int i = 1; i + 1 < vi.size(); i++)
+        obj->addFace(Face{vi[0], vi[i], vi[i + 1], ti[0], ti[i], ti[i + 1], ni[0], ni[i], ni[i + 1]});
+    // the polygon based ones get the face itself, unless it is concave
+    if (vi.size() == 3 || __isConvex(vi))
     {
-        ss >> c;
-        if (ss.peek() != '/')
-        {
-            ss >> uv2;
-        }
-        if (ss.peek() == '/')
-        {
-            ss >> c;
-            ss >> n2;
-        }
+        obj->addPolygon(vi.data(), vi.size());
+        return;
     }
-    // v3//n3 or v3/vt3/vn3 or v3/vt3 or v3
-    ss >> v3;
-    if (ss.peek() == '/')
+    for (int i = 1; i + 1 < vi.size(); i++)
     {
-        ss >> c;
-        if (ss.peek() != '/')
-        {
-            ss >> uv3;
-        }
-        if (ss.peek() == '/')
-        {
-            ss >> c;
-            ss >> n3;
-        }
+        VertexIndex triangle[3] = {vi[0], vi[i], vi[i + 1]};
+        obj->addPolygon(triangle, 3);
+    }
+}
+
+bool OBJLoader::__isConvex(const std::vector<VertexIndex> &indices) const
+{
+    // every corner turns the same way around the (Newell) face normal
+    auto &vertices = obj->getVertices();
+    int n = indices.size();
+    glm::vec3 normal(0.0f);
+    for (int i = 0; i < n; i++)
+    {
+        auto &v0 = vertices[indices[i]];
+        auto &v1 = vertices[indices[(i + 1) % n]];
+        normal.x += (v0.y - v1.y) * (v0.z + v1.z);
+        normal.y += (v0.z - v1.z) * (v0.x + v1.x);
+        normal.z += (v0.x - v1.x) * (v0.y + v1.y);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        auto &v0 = vertices[indices[i]];
+        auto &v1 = vertices[indices[(i + 1) % n]];
+        auto &v2 = vertices[indices[(i + 2) % n]];
+        glm::vec3 e0(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+        glm::vec3 e1(v2.x - v1.x, v2.y - v1.y, v2.z - v1.z);
+        if (glm::dot(glm::cross(e0, e1), normal) < 0.0f)
+            return false;
     }
-    return Face{v1, v2, v3, uv1, uv2, uv3, n1, n2, n3};
+    return true;
 }
 
 void OBJLoader::__autoAddNormal()
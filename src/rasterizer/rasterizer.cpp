@@ -217,6 +217,7 @@ void Rasterizer::_drawLineScreenSpace(const glm::vec2 &p0, const glm::vec2 &p1,
     {
         if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
         {
+            canvas->markDirty(x0, y0);
             textureMap[(y0 * width + x0) * 3] = r;
             textureMap[(y0 * width + x0) * 3 + 1] = g;
             textureMap[(y0 * width + x0) * 3 + 2] = b;
@@ -0,0 +1,91 @@
+#include <zbuffer/scanline.hpp>
+
+void Scanline::__scanRowIntervals(ScanContext &context, int y)
+{
+    auto &active = context.activeEdgeTable;
+    auto &events = context.events;
+    events.clear();
+    context.spans.resize(context.activePolygonTable.size());
+    for (int k = 0; k < context.activePolygonTable.size(); k++)
+    {
+        int xStart = EdgePool::ceil(active.x[2 * k]);
+        int xEnd = EdgePool::ceil(active.x[2 * k + 1]);
+        xEnd = xEnd > width - 1 ? width - 1 : xEnd;
+        xStart = xStart > 0 ? xStart : 0;
+        if (xStart >= xEnd)
+            continue;
+        context.spans[k] = __spanShading(active, k);
+        events.push_back({xStart, k, true});
+        events.push_back({xEnd, k, false});
+    }
+    std::sort(events.begin(), events.end(), [](const IntervalEvent &e0, const IntervalEvent &e1) -> bool
+              { return e0.x < e1.x; });
+    // between two event positions the covering polygons do not change
+    auto &covering = context.covering;
+    covering.clear();
+    for (int i = 0; i < events.size();)
+    {
+        int x = events[i].x;
+        for (; i < events.size() && events[i].x == x; i++)
+        {
+            if (events[i].enter)
+                covering.push_back(events[i].k);
+            else
+                covering.erase(std::find(covering.begin(), covering.end(), events[i].k));
+        }
+        if (i < events.size() && !covering.empty())
+            __resolveInterval(context, y, x, events[i].x);
+    }
+}
+
+void Scanline::__resolveInterval(ScanContext &context, int y, int xStart, int xEnd)
+{
+    // the nearest polygon at both ends is the nearest over the whole interval, since depths are linear in x
+    auto &activePolygons = context.activePolygonTable;
+    auto nearest = [&](int x) -> int
+    {
+        int best = context.covering[0];
+        float bestZ = polygonDepths[activePolygons[best].pId].at(x, y);
+        for (int i = 1; i < context.covering.size(); i++)
+        {
+            int k = context.covering[i];
+            float z = polygonDepths[activePolygons[k].pId].at(x, y);
+            if (z < bestZ || (z == bestZ && k < best)) // ties go to the earlier polygon, like the z-buffer mode
+                best = k, bestZ = z;
+        }
+        return best;
+    };
+    int kStart = nearest(xStart), kEnd = nearest(xEnd - 1);
+    if (kStart == kEnd || xEnd - xStart == 1)
+    {
+        __writeRun(context, kStart, y, xStart, xEnd);
+        return;
+    }
+    // split where the two winners' depths cross, each half is resolved on its own
+    auto &p0 = polygonDepths[activePolygons[kStart].pId];
+    auto &p1 = polygonDepths[activePolygons[kEnd].pId];
+    float d0 = p1.at(xStart, y) - p0.at(xStart, y), d1 = p1.at(xEnd - 1, y) - p0.at(xEnd - 1, y);
+    int xSplit = xStart + 1;
+    if (d0 != d1)
+        xSplit = (int)std::floor(xStart + d0 / (d0 - d1) * (xEnd - 1 - xStart)) + 1;
+    xSplit = xSplit < xStart + 1 ? xStart + 1 : (xSplit > xEnd - 1 ? xEnd - 1 : xSplit);
+    __resolveInterval(context, y, xStart, xSplit);
+    __resolveInterval(context, y, xSplit, xEnd);
+}
+
+void Scanline::__writeRun(ScanContext &context, int k, int y, int xStart, int xEnd)
+{
+    auto &span = context.spans[k];
+    context.dirtyTiles.markRect(xStart, y, xEnd - 1, y);
+    context.intervalCount++;
+    float r = span.r + (xStart - span.x0) * span.dr;
+    float g = span.g + (xStart - span.x0) * span.dg;
+    float b = span.b + (xStart - span.x0) * span.db;
+    for (int x = xStart; x < xEnd; x++)
+    {
+        zBufferData[y * width + x] = __encodeNormal(r, g, b);
+        r += span.dr;
+        g += span.dg;
+        b += span.db;
+    }
+}
@@ -1,9 +1,13 @@
 #include <zbuffer/naivezbuffer.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-NaiveZBuffer::NaiveZBuffer(int width, int height) : width(width), height(height)
+NaiveZBuffer::NaiveZBuffer(int width, int height) : width(width), height(height), layout(width, height), dirtyTiles(width, height)
 {
-    zBufferData = new float[width * height];
-    colorBufferData = new float[width * height * 3];
+    // sized for the padded tiled layout, which is never smaller than width * height
+    zBufferData = new float[layout.size()];
+    colorBufferData = new float[layout.size() * 3];
 }
 
 NaiveZBuffer::~NaiveZBuffer()
@@ -14,14 +18,24 @@ NaiveZBuffer::~NaiveZBuffer()
 
 void NaiveZBuffer::init()
 {
-    std::fill(zBufferData, zBufferData + width * height, std::numeric_limits<float>::infinity());
-    std::fill(colorBufferData, colorBufferData + width * height * 3, 0.0f);
+    if (layout.tiled != use_tiled_layout) // pixels move when the layout changes
+    {
+        layout.tiled = use_tiled_layout;
+        dirtyTiles.markAll();
+        for (auto &buffer : sortLastBuffers)
+            buffer->dirtyTiles.markAll();
+    }
+    dirtyTiles.clear(zBufferData, 1, std::numeric_limits<float>::infinity(), layout.tiled);
+    dirtyTiles.clear(colorBufferData, 3, 0.0f, layout.tiled);
+    dirtyTiles.reset();
     // clear
     vertices.clear();
     faces.clear();
     triangles.clear();
     obj_vertex_offset = 0;
     culled_face = 0;
+    small_triangle_count = 0;
+    large_triangle_count = 0;
 }
 
 void NaiveZBuffer::prepareVertex(OBJ &obj, Camera &camera)
@@ -40,21 +54,10 @@ void NaiveZBuffer::__vertexShader(OBJ &obj, Camera &camera)
     auto &faces_ = obj.getFaces();
     auto &vertices_ = obj.getVertices();
     glm::mat4 MVP = camera.getViewProjectionMatrix() * obj.getModelMatrix();
-    for (auto &v : vertices_)
-    {
-        glm::vec4 v4(v.x, v.y, v.z, 1.0f);
-        v4 = MVP * v4;
-        Vertex vertex(v4.x / v4.w, v4.y / v4.w, v4.z / v4.w);
-        vertex.x = (vertex.x + 1.0f) * width / 2.0f;
-        vertex.y = (vertex.y + 1.0f) * height / 2.0f;
-        vertex.nx = v.nx;
-        vertex.ny = v.ny;
-        vertex.nz = v.nz;
-        // vertex.nx = std::fabs(v.nx);
-        // vertex.ny = std::fabs(v.ny);
-        // vertex.nz = std::fabs(v.nz);
-        vertices.push_back(vertex);
-    }
+    __withPipeline([&](const auto &pipeline)
+                   {
+        for (auto &v : vertices_)
+            vertices.push_back(pipeline.vertexShader(v, MVP, width, height)); });
     // build triangles
     for (int face_index = 0; face_index < faces_.size(); face_index++)
     {
@@ -72,6 +75,7 @@ void NaiveZBuffer::__vertexShader(OBJ &obj, Camera &camera)
         triangle.bb.xMax = std::ceil(v0.x > v1.x ? (v0.x > v2.x ? v0.x : v2.x) : (v1.x > v2.x ? v1.x : v2.x));
         triangle.bb.yMin = std::floor(v0.y < v1.y ? (v0.y < v2.y ? v0.y : v2.y) : (v1.y < v2.y ? v1.y : v2.y));
         triangle.bb.yMax = std::ceil(v0.y > v1.y ? (v0.y > v2.y ? v0.y : v2.y) : (v1.y > v2.y ? v1.y : v2.y));
+        triangle.isSmall = triangle.bb.xMax - triangle.bb.xMin < SmallTriangleExtent && triangle.bb.yMax - triangle.bb.yMin < SmallTriangleExtent;
         if (__ifTriangleInScreen(triangle))
             triangles.push_back(triangle);
     }
@@ -80,51 +84,238 @@ void NaiveZBuffer::__vertexShader(OBJ &obj, Camera &camera)
 
 void NaiveZBuffer::__fragmentShader()
 {
-    for (auto &triangle : triangles)
+    if (use_sort_last)
+        __fragmentShaderSortLast();
+    else
+        __drawTriangles(0, triangles.size(), RenderTarget{zBufferData, colorBufferData, &dirtyTiles}, small_triangle_count, large_triangle_count);
+    if (use_cull_face)
+        culled_face = faces.size() - triangles.size();
+}
+
+void NaiveZBuffer::__fragmentShaderSortLast()
+{
+    int workers = 1;
+#ifdef _OPENMP
+    workers = omp_get_max_threads();
+#endif
+    sort_last_workers = workers;
+    while (sortLastBuffers.size() + 1 < workers)
+        sortLastBuffers.push_back(std::make_unique<SortLastBuffer>(layout, width, height));
+    int triangleCount = triangles.size();
+    int smallCount = 0, largeCount = 0;
+#pragma omp parallel for num_threads(workers) schedule(static, 1) reduction(+ : smallCount, largeCount)
+    for (int w = 0; w < workers; w++)
+    {
+        RenderTarget target{zBufferData, colorBufferData, &dirtyTiles};
+        if (w > 0)
+        {
+            auto &buffer = *sortLastBuffers[w - 1];
+            buffer.dirtyTiles.clear(buffer.zBuffer.data(), 1, std::numeric_limits<float>::infinity(), layout.tiled);
+            buffer.dirtyTiles.clear(buffer.colorBuffer.data(), 3, 0.0f, layout.tiled);
+            buffer.dirtyTiles.reset();
+            target = RenderTarget{buffer.zBuffer.data(), buffer.colorBuffer.data(), &buffer.dirtyTiles};
+        }
+        // contiguous chunks keep each object's triangles together in as few workers as possible
+        __drawTriangles((long long)triangleCount * w / workers, (long long)triangleCount * (w + 1) / workers, target, smallCount, largeCount);
+    }
+    small_triangle_count += smallCount;
+    large_triangle_count += largeCount;
+    __compositeSortLast();
+}
+
+void NaiveZBuffer::__compositeSortLast()
+{
+    // per-pixel min-depth select over the tiles each worker wrote, merged in worker order
+    // with a strict compare, so depth ties resolve to the earlier triangle like the serial path
+    for (int w = 1; w < sort_last_workers; w++)
+    {
+        auto &buffer = *sortLastBuffers[w - 1];
+        const float *zSource = buffer.zBuffer.data();
+        const float *colorSource = buffer.colorBuffer.data();
+        auto &tiles = buffer.dirtyTiles.dirtyTileIds();
+#pragma omp parallel for
+        for (int t = 0; t < (int)tiles.size(); t++)
+            buffer.dirtyTiles.forEachRun(tiles[t], layout.tiled, [&](int begin, int end)
+                                         {
+#pragma omp simd
+                for (int i = begin; i < end; i++)
+                {
+                    bool closer = zSource[i] < zBufferData[i];
+                    zBufferData[i] = closer ? zSource[i] : zBufferData[i];
+                    colorBufferData[i * 3] = closer ? colorSource[i * 3] : colorBufferData[i * 3];
+                    colorBufferData[i * 3 + 1] = closer ? colorSource[i * 3 + 1] : colorBufferData[i * 3 + 1];
+                    colorBufferData[i * 3 + 2] = closer ? colorSource[i * 3 + 2] : colorBufferData[i * 3 + 2];
+                } });
+        dirtyTiles.merge(buffer.dirtyTiles);
+    }
+}
+
+template <typename F>
+void NaiveZBuffer::__withPipeline(F &&f) const
+{
+    switch (cull_mode)
+    {
+    case CullMode::None:
+        __withPipelineCulled<CullMode::None>(f);
+        break;
+    case CullMode::Back:
+        __withPipelineCulled<CullMode::Back>(f);
+        break;
+    case CullMode::Front:
+        __withPipelineCulled<CullMode::Front>(f);
+        break;
+    }
+}
+
+template <CullMode Cull, typename F>
+void NaiveZBuffer::__withPipelineCulled(F &&f) const
+{
+    switch (shading_mode)
+    {
+    case ShadingMode::NormalColor:
+        f(NormalColorPipeline<Cull>());
+        break;
+    case ShadingMode::FlatColor:
+        f(FlatColorPipeline<Cull>());
+        break;
+    case ShadingMode::DepthOnly:
+        f(DepthOnlyPipeline<Cull>());
+        break;
+    }
+}
+
+void NaiveZBuffer::__drawTriangles(int begin, int end, const RenderTarget &target, int &smallCount, int &largeCount)
+{
+    // pick the specialized raster loops once per range
+    __withPipeline([&](const auto &pipeline)
+                   { __drawTrianglesWith(pipeline, begin, end, target, smallCount, largeCount); });
+}
+
+template <typename P>
+void NaiveZBuffer::__drawTrianglesWith(const P &pipeline, int begin, int end, const RenderTarget &target, int &smallCount, int &largeCount)
+{
+    const Triangle *batch[SmallTriangleBatch];
+    int batchSize = 0;
+    for (int i = begin; i < end; i++)
     {
+        auto &triangle = triangles[i];
         float area = triangle.calculateArea(vertices);
-        if (area == 0.0f)
+        if (area == 0.0f || pipeline.culled(vertices[triangle.v0], vertices[triangle.v1], vertices[triangle.v2]))
+            continue;
+        target.dirtyTiles->markRect(triangle.bb.xMin, triangle.bb.yMin, triangle.bb.xMax, triangle.bb.yMax);
+        if (use_small_triangle_path && triangle.isSmall)
+        {
+            batch[batchSize++] = &triangle;
+            if (batchSize == SmallTriangleBatch)
+            {
+                __drawSmallTriangles(pipeline, batch, batchSize, target);
+                smallCount += batchSize;
+                batchSize = 0;
+            }
             continue;
-        __drawTriangle(triangle);
+        }
+        // flush first so the draw order (and depth ties) match the per-triangle path
+        __drawSmallTriangles(pipeline, batch, batchSize, target);
+        smallCount += batchSize;
+        batchSize = 0;
+        __drawTriangle(pipeline, triangle, target);
+        largeCount++;
     }
-    if (use_cull_face)
-        culled_face = faces.size() - triangles.size();
+    __drawSmallTriangles(pipeline, batch, batchSize, target);
+    smallCount += batchSize;
 }
 
-bool NaiveZBuffer::__ifLambda12InsideTriangle(float l1, float l2)
+template <typename P>
+void NaiveZBuffer::__drawSmallTriangles(const P &pipeline, const Triangle *const *batch, int count, const RenderTarget &target)
 {
-    return l1 >= 0 && l2 >= 0 && 1 - l1 - l2 >= 0;
+    // one triangle per lane, every lane tests the same few candidate pixel centers of its own bounding box
+    constexpr int N = SmallTriangleBatch;
+    if (count == 0)
+        return;
+    alignas(32) float v0x[N], v0y[N], v1x[N], v1y[N], v2x[N], v2y[N], invArea2[N];
+    alignas(32) float z0[N], z1[N], z2[N];
+    alignas(32) int xStart[N], xEnd[N], yStart[N], yEnd[N];
+    for (int l = 0; l < N; l++)
+    {
+        const Triangle &triangle = *batch[l < count ? l : 0]; // pad with lane 0, padded lanes are never written
+        auto &v0 = vertices[triangle.v0];
+        auto &v1 = vertices[triangle.v1];
+        auto &v2 = vertices[triangle.v2];
+        v0x[l] = v0.x, v0y[l] = v0.y, v1x[l] = v1.x, v1y[l] = v1.y, v2x[l] = v2.x, v2y[l] = v2.y;
+        z0[l] = v0.z, z1[l] = v1.z, z2[l] = v2.z;
+        xStart[l] = 0 < triangle.bb.xMin ? triangle.bb.xMin : 0;
+        xEnd[l] = width - 1 < triangle.bb.xMax ? width - 1 : triangle.bb.xMax;
+        yStart[l] = 0 < triangle.bb.yMin ? triangle.bb.yMin : 0;
+        yEnd[l] = height - 1 < triangle.bb.yMax ? height - 1 : triangle.bb.yMax;
+    }
+#pragma omp simd
+    for (int l = 0; l < N; l++)
+    {
+        float area = 0.5f * (-v1y[l] * v2x[l] + v0y[l] * (-v1x[l] + v2x[l]) + v0x[l] * (v1y[l] - v2y[l]) + v1x[l] * v2y[l]);
+        invArea2[l] = 1 / (2 * area);
+    }
+    // evaluate every candidate in SIMD first, then write triangle by triangle so the draw order (and depth ties) match the per-triangle path
+    constexpr int C = SmallTriangleExtent * SmallTriangleExtent;
+    alignas(32) float depth[C][N], lambda1[C][N], lambda2[C][N], lambda3[C][N];
+    alignas(32) int inside[C][N];
+    for (int c = 0; c < C; c++)
+    {
+        int dx = c % SmallTriangleExtent, dy = c / SmallTriangleExtent;
+#pragma omp simd
+        for (int l = 0; l < N; l++)
+        {
+            float x = (float)(xStart[l] + dx), y = (float)(yStart[l] + dy);
+            lambda2[c][l] = invArea2[l] * (v0y[l] * v2x[l] - v0x[l] * v2y[l] + (v2y[l] - v0y[l]) * x + (v0x[l] - v2x[l]) * y);
+            lambda3[c][l] = invArea2[l] * (v0x[l] * v1y[l] - v0y[l] * v1x[l] + (v0y[l] - v1y[l]) * x + (v1x[l] - v0x[l]) * y);
+            lambda1[c][l] = 1 - lambda2[c][l] - lambda3[c][l];
+            inside[c][l] = lambda1[c][l] >= 0 && lambda2[c][l] >= 0 && 1 - lambda1[c][l] - lambda2[c][l] >= 0 &&
+                           xStart[l] + dx <= xEnd[l] && yStart[l] + dy <= yEnd[l];
+            depth[c][l] = lambda1[c][l] * z0[l] + lambda2[c][l] * z1[l] + lambda3[c][l] * z2[l];
+        }
+    }
+    for (int l = 0; l < count; l++) // lane order is draw order
+        for (int c = 0; c < C; c++)
+        {
+            if (!inside[c][l])
+                continue;
+            int index = layout.index(xStart[l] + c % SmallTriangleExtent, yStart[l] + c / SmallTriangleExtent);
+            if (!pipeline.depthTest(depth[c][l], target.zBuffer[index]))
+                continue;
+            target.zBuffer[index] = depth[c][l];
+            pipeline.shade(vertices[batch[l]->v0], vertices[batch[l]->v1], vertices[batch[l]->v2],
+                           lambda1[c][l], lambda2[c][l], lambda3[c][l], target.colorBuffer + index * 3);
+        }
 }
 
-void NaiveZBuffer::__drawTriangle(const Triangle &triangle)
+template <typename P>
+void NaiveZBuffer::__drawTriangle(const P &pipeline, const Triangle &triangle, const RenderTarget &target)
 {
+    // __drawTrianglesWith has face culled the triangle already, its rows / tiles are rasterized without testing it again
     int xStart = 0 < triangle.bb.xMin ? triangle.bb.xMin : 0;
     int xEnd = width - 1 < triangle.bb.xMax ? width - 1 : triangle.bb.xMax;
     int yStart = 0 < triangle.bb.yMin ? triangle.bb.yMin : 0;
     int yEnd = height - 1 < triangle.bb.yMax ? height - 1 : triangle.bb.yMax;
+    auto &v0 = vertices[triangle.v0];
+    auto &v1 = vertices[triangle.v1];
+    auto &v2 = vertices[triangle.v2];
+    if (layout.tiled)
+    {
+        // walk the covered tiles, each tile is one contiguous block of memory
+        int tileXStart = xStart >> TiledLayout::TileShift, tileXEnd = xEnd >> TiledLayout::TileShift;
+        int tileYStart = yStart >> TiledLayout::TileShift, tileYEnd = yEnd >> TiledLayout::TileShift;
 #pragma omp parallel for collapse(2)
-    for (int x = xStart; x <= xEnd; x++)
-        for (int y = yStart; y <= yEnd; y++)
-        {
-            float lambda1, lambda2, lambda3;
-            __ComputeBarycentricCoords(x, y, triangle, lambda2, lambda3);
-            lambda1 = 1 - lambda2 - lambda3;
-            if (__ifLambda12InsideTriangle(lambda1, lambda2))
+        for (int ty = tileYStart; ty <= tileYEnd; ty++)
+            for (int tx = tileXStart; tx <= tileXEnd; tx++)
             {
-                float z = lambda1 * vertices[triangle.v0].z + lambda2 * vertices[triangle.v1].z + lambda3 * vertices[triangle.v2].z;
-                float R = lambda1 * vertices[triangle.v0].nx + lambda2 * vertices[triangle.v1].nx + lambda3 * vertices[triangle.v2].nx;
-                float G = lambda1 * vertices[triangle.v0].ny + lambda2 * vertices[triangle.v1].ny + lambda3 * vertices[triangle.v2].ny;
-                float B = lambda1 * vertices[triangle.v0].nz + lambda2 * vertices[triangle.v1].nz + lambda3 * vertices[triangle.v2].nz;
-#pragma omp critical
-                if (z < zBufferData[y * width + x])
-                {
-                    zBufferData[y * width + x] = z;
-                    colorBufferData[(y * width + x) * 3] = R;
-                    colorBufferData[(y * width + x) * 3 + 1] = G;
-                    colorBufferData[(y * width + x) * 3 + 2] = B;
-                }
+                int x0 = Max2(xStart, tx << TiledLayout::TileShift), x1 = Min2(xEnd, (tx << TiledLayout::TileShift) + TiledLayout::TileMask);
+                int y0 = Max2(yStart, ty << TiledLayout::TileShift), y1 = Min2(yEnd, (ty << TiledLayout::TileShift) + TiledLayout::TileMask);
+                pipeline.rasterizeTriangle(v0, v1, v2, x0, x1, y0, y1, target.zBuffer, target.colorBuffer, layout);
             }
-        }
+        return;
+    }
+#pragma omp parallel for
+    for (int y = yStart; y <= yEnd; y++) // rows are disjoint, no lock needed
+        pipeline.rasterizeTriangle(v0, v1, v2, xStart, xEnd, y, y, target.zBuffer, target.colorBuffer, layout);
 }
 
 void NaiveZBuffer::__drawTriangleFrame(const Triangle &triangle)
@@ -179,9 +370,11 @@ void NaiveZBuffer::__drawLineScreenSpace(const glm::vec2 &p0, const glm::vec2 &p
     {
         if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
         {
-            textureMap[(y0 * width + x0) * 3] = r;
-            textureMap[(y0 * width + x0) * 3 + 1] = g;
-            textureMap[(y0 * width + x0) * 3 + 2] = b;
+            int index = layout.index(x0, y0);
+            dirtyTiles.markPixel(x0, y0);
+            textureMap[index * 3] = r;
+            textureMap[index * 3 + 1] = g;
+            textureMap[index * 3 + 2] = b;
         }
         if (x0 == x1 && y0 == y1)
             break;
@@ -198,14 +391,3 @@ void NaiveZBuffer::__drawLineScreenSpace(const glm::vec2 &p0, const glm::vec2 &p
         }
     }
 }
-
-void NaiveZBuffer::__ComputeBarycentricCoords(int x, int y, const Triangle &triangle, float &lambda1, float &lambda2)
-{
-    // barycentric coordinate
-    auto &v0 = vertices[triangle.v0];
-    auto &v1 = vertices[triangle.v1];
-    auto &v2 = vertices[triangle.v2];
-    float area = 0.5f * (-v1.y * v2.x + v0.y * (-v1.x + v2.x) + v0.x * (v1.y - v2.y) + v1.x * v2.y);
-    lambda1 = 1 / (2 * area) * (v0.y * v2.x - v0.x * v2.y + (v2.y - v0.y) * x + (v0.x - v2.x) * y);
-    lambda2 = 1 / (2 * area) * (v0.x * v1.y - v0.y * v1.x + (v0.y - v1.y) * x + (v1.x - v0.x) * y);
-}
\ No newline at end of file
@@ -22,12 +22,18 @@ void NaiveZBufferRaster::render()
 void NaiveZBufferRaster::__putColorBuffer2TextureMap()
 {
     auto textureMap = canvas->getTextureMap();
-    for (int i = 0; i < width * height * 3; i++)
-    {
-        float climped = colorPrecompute[i] > 1.0f ? 1.0f : colorPrecompute[i];
-        climped = climped < 0.0f ? 0.0f : climped;
-        textureMap[i] = (unsigned char)(int)(climped * 255);
-    }
+    auto &layout = zbuffer->layout;
+    for (int y = 0; y < height; y++) // de-swizzle to row-major while converting
+        for (int x = 0; x < width; x++)
+        {
+            int src = layout.index(x, y) * 3, dst = (y * width + x) * 3;
+            for (int c = 0; c < 3; c++)
+            {
+                float climped = colorPrecompute[src + c] > 1.0f ? 1.0f : colorPrecompute[src + c];
+                climped = climped < 0.0f ? 0.0f : climped;
+                textureMap[dst + c] = (unsigned char)(int)(climped * 255);
+            }
+        }
 }
 
 void NaiveZBufferRaster::__showZBufferDataStructInfo()
@@ -38,6 +44,31 @@ void NaiveZBufferRaster::__showZBufferDataStructInfo()
     ImGui::Text("Triangle Count: %d", zbuffer->triangles.size());
     // use cull face
     ImGui::Checkbox("Use Cull Face", &zbuffer->use_cull_face);
+    ImGui::Text("Shading:");
+    if (ImGui::RadioButton("Normal Color", zbuffer->shading_mode == NaiveZBuffer::ShadingMode::NormalColor))
+        zbuffer->shading_mode = NaiveZBuffer::ShadingMode::NormalColor;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Flat Color", zbuffer->shading_mode == NaiveZBuffer::ShadingMode::FlatColor))
+        zbuffer->shading_mode = NaiveZBuffer::ShadingMode::FlatColor;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Depth Only", zbuffer->shading_mode == NaiveZBuffer::ShadingMode::DepthOnly))
+        zbuffer->shading_mode = NaiveZBuffer::ShadingMode::DepthOnly;
+    ImGui::Text("Face Culling:");
+    if (ImGui::RadioButton("None", zbuffer->cull_mode == CullMode::None))
+        zbuffer->cull_mode = CullMode::None;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Back", zbuffer->cull_mode == CullMode::Back))
+        zbuffer->cull_mode = CullMode::Back;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Front", zbuffer->cull_mode == CullMode::Front))
+        zbuffer->cull_mode = CullMode::Front;
+    ImGui::Checkbox("Use Tiled Framebuffer", &zbuffer->use_tiled_layout);
+    ImGui::Checkbox("Use Small Triangle Path", &zbuffer->use_small_triangle_path);
+    ImGui::Text("Small Triangles (batched): %d", zbuffer->small_triangle_count);
+    ImGui::Text("Large Triangles: %d", zbuffer->large_triangle_count);
+    ImGui::Checkbox("Use Sort-Last Parallel", &zbuffer->use_sort_last);
+    if (zbuffer->use_sort_last)
+        ImGui::Text("Sort-Last Workers: %d", zbuffer->sort_last_workers);
     if (zbuffer->use_cull_face)
     {
         ImGui::Text("Culled Face Count: %d", zbuffer->culled_face);
@@ -1,241 +1,554 @@
 #include <zbuffer/scanline.hpp>
-Scanline::Edge::Edge(Vertex v0, Vertex v1, int eId) : eId(eId)
-{
-    xStart = v0.x; // xyz
-    xEnd = v1.x;
-    zStart = v0.z;
-    zEnd = v1.z;
-    yMin = v0.y;
-    yMax = v1.y;
-    xSlope = (xEnd - xStart) / (yMax - yMin);
-    zSlope = (zEnd - zStart) / (yMax - yMin);
-    rStart = v0.nx; // rgb
-    gStart = v0.ny;
-    bStart = v0.nz;
-    rEnd = v1.nx;
-    gEnd = v1.ny;
-    bEnd = v1.nz;
-    rSlope = (rEnd - rStart) / (yMax - yMin);
-    gSlope = (gEnd - gStart) / (yMax - yMin);
-    bSlope = (bEnd - bStart) / (yMax - yMin);
-
-    xStartFixed = xStart;
-    yStartFixed = yMin;
-    zStartFixed = zStart;
-    rStartFixed = rStart;
-    gStartFixed = gStart;
-    bStartFixed = bStart;
-}
-
-void Scanline::Edge::edgeStepToIntegerY(int integerY)
-{
-    float integer_f = (float)integerY;
-    float delta0_1 = (integer_f - yStartFixed) / (yMax - yStartFixed);
-    xStart = xStartFixed + delta0_1 * (xEnd - xStartFixed);
-    zStart = zStartFixed + delta0_1 * (zEnd - zStartFixed);
-    rStart = rStartFixed + delta0_1 * (rEnd - rStart);
-    gStart = gStartFixed + delta0_1 * (gEnd - gStart);
-    bStart = bStartFixed + delta0_1 * (bEnd - bStart);
-}
-
-Scanline::Scanline(int width, int height) : width(width), height(height)
+
+void Scanline::EdgePool::clear()
+{
+    x.clear(), dx.clear();
+    r.clear(), g.clear(), b.clear();
+    dr.clear(), dg.clear(), db.clear();
+    yStart.clear(), yEnd.clear();
+}
+
+void Scanline::EdgePool::resize(int n)
+{
+    x.resize(n), dx.resize(n);
+    r.resize(n), g.resize(n), b.resize(n);
+    dr.resize(n), dg.resize(n), db.resize(n);
+    yStart.resize(n), yEnd.resize(n);
+}
+
+void Scanline::EdgePool::place(int offset, const EdgePool &from)
+{
+    std::copy(from.x.begin(), from.x.end(), x.begin() + offset);
+    std::copy(from.dx.begin(), from.dx.end(), dx.begin() + offset);
+    std::copy(from.r.begin(), from.r.end(), r.begin() + offset);
+    std::copy(from.g.begin(), from.g.end(), g.begin() + offset);
+    std::copy(from.b.begin(), from.b.end(), b.begin() + offset);
+    std::copy(from.dr.begin(), from.dr.end(), dr.begin() + offset);
+    std::copy(from.dg.begin(), from.dg.end(), dg.begin() + offset);
+    std::copy(from.db.begin(), from.db.end(), db.begin() + offset);
+    std::copy(from.yStart.begin(), from.yStart.end(), yStart.begin() + offset);
+    std::copy(from.yEnd.begin(), from.yEnd.end(), yEnd.begin() + offset);
+}
+
+void Scanline::EdgePool::move(int to, int from)
+{
+    if (to == from)
+        return;
+    x[to] = x[from], dx[to] = dx[from];
+    r[to] = r[from], g[to] = g[from], b[to] = b[from];
+    dr[to] = dr[from], dg[to] = dg[from], db[to] = db[from];
+    yStart[to] = yStart[from], yEnd[to] = yEnd[from];
+}
+
+void Scanline::EdgePool::set(int slot, const EdgePool &from, int e, int y)
+{
+    if (slot == size())
+        resize(slot + 1);
+    // catch up in one step, exact like stepping row by row
+    int64_t steps = y - from.yStart[e];
+    x[slot] = from.x[e] + steps * from.dx[e];
+    r[slot] = from.r[e] + (int32_t)(steps * from.dr[e]);
+    g[slot] = from.g[e] + (int32_t)(steps * from.dg[e]);
+    b[slot] = from.b[e] + (int32_t)(steps * from.db[e]);
+    dx[slot] = from.dx[e];
+    dr[slot] = from.dr[e], dg[slot] = from.dg[e], db[slot] = from.db[e];
+    yStart[slot] = y;
+    yEnd[slot] = from.yEnd[e];
+}
+
+int Scanline::EdgePool::push(const Vertex &v0, const Vertex &v1, int y, int yEnd_)
+{
+    // start exactly on scanline y, the steps are exact from there on
+    double dy = (double)v1.y - v0.y;
+    double t = (y - v0.y) / dy;
+    x.push_back(toFixed(v0.x + t * (v1.x - v0.x)));
+    r.push_back(toFixed(v0.nx + t * (v1.nx - v0.nx)));
+    g.push_back(toFixed(v0.ny + t * (v1.ny - v0.ny)));
+    b.push_back(toFixed(v0.nz + t * (v1.nz - v0.nz)));
+    dx.push_back(toFixed((v1.x - v0.x) / dy));
+    dr.push_back(toFixed((v1.nx - v0.nx) / dy));
+    dg.push_back(toFixed((v1.ny - v0.ny) / dy));
+    db.push_back(toFixed((v1.nz - v0.nz) / dy));
+    yStart.push_back(y);
+    yEnd.push_back(yEnd_);
+    return size() - 1;
+}
+
+Scanline::Scanline(int width, int height) : width(width), height(height), dirtyTiles(width, height)
 {
     zBufferData = new float[width * height];
-    zBuffer.resize(width * height);
 }
 
 void Scanline::init()
 {
-    activeTable.clear();
-    deactiveTable.clear();
-    activeTable.resize(height);
-    deactiveTable.resize(height);
     obj_face_offset = 0;
     obj_vertex_offset = 0;
     vertices.clear();
-    std::fill(zBuffer.begin(), zBuffer.end(), std::numeric_limits<float>::infinity());
-    std::fill(zBufferData, zBufferData + width * height, 0);
+    TotalEdgeTable.clear();
+    polygonDepths.clear();
+    polygonEdgeBegin.assign(1, 0);
+    polygonYStart.clear();
+    polygonYEnd.clear();
+    if (use_row_depth)
+        std::vector<float>().swap(zBuffer); // the full frame depth is not needed, give the memory back
+    else if (zBuffer.empty())
+        zBuffer.assign(width * height, std::numeric_limits<float>::infinity());
+    else
+        dirtyTiles.clear(zBuffer.data(), 1, std::numeric_limits<float>::infinity());
+    dirtyTiles.clear(zBufferData, 1, 0.0f);
+    dirtyTiles.reset();
 }
 
 void Scanline::buildTable(OBJ &obj, Camera &camera)
 {
-    auto &faces = obj.getFaces();
-    auto &vertices_ = obj.getVertices();
-    auto vertices__ = vertices_;
-    // add to vertices
-    glm::mat4 MVP = camera.getViewProjectionMatrix() * obj.getModelMatrix();
-    for (auto &v : vertices__)
-    {
-        glm::vec4 v4(v.x, v.y, v.z, 1.0f);
-        v4 = MVP * v4;
-        v.x = v4.x / v4.w;
-        v.y = v4.y / v4.w;
-        v.z = v4.z / v4.w;
-        v.x = (v.x + 1.0f) * width / 2.0f; // from world space to screen space
-        v.y = (v.y + 1.0f) * height / 2.0f;
-    }
-    vertices.insert(vertices.end(), vertices__.begin(), vertices__.end());
-    for (int face_index = 0; face_index < faces.size(); face_index++)
-    {
-        auto &face = faces[face_index];
-        Polygon polygon;
-        polygon.pid = face_index + obj_face_offset;
-        polygon.vertices.push_back(vertices[face.v0 + obj_vertex_offset]);
-        polygon.vertices.push_back(vertices[face.v1 + obj_vertex_offset]);
-        polygon.vertices.push_back(vertices[face.v2 + obj_vertex_offset]);
-        // compute the plane equation
-        auto &v0 = polygon.vertices[0];
-        auto &v1 = polygon.vertices[1];
-        auto &v2 = polygon.vertices[2];
+    buildTables({&obj}, camera);
+}
+
+void Scanline::buildTables(const std::vector<OBJ *> &objs, Camera &camera)
+{
+    // add to vertices, then to screen space in place
+    std::vector<int> polygonOffset(objs.size() + 1, 0), vertexOffset(objs.size(), 0);
+    for (int o = 0; o < objs.size(); o++)
+    {
+        vertexOffset[o] = vertices.size();
+        polygonOffset[o + 1] = polygonOffset[o] + objs[o]->getPolygonCount();
+        auto &vertices_ = objs[o]->getVertices();
+        vertices.insert(vertices.end(), vertices_.begin(), vertices_.end());
+        glm::mat4 MVP = camera.getViewProjectionMatrix() * objs[o]->getModelMatrix();
+        int vertexEnd = vertices.size();
+#pragma omp parallel for
+        for (int i = vertexOffset[o]; i < vertexEnd; i++)
+        {
+            auto &v = vertices[i];
+            glm::vec4 v4(v.x, v.y, v.z, 1.0f);
+            v4 = MVP * v4;
+            v.x = v4.x / v4.w;
+            v.y = v4.y / v4.w;
+            v.z = v4.z / v4.w;
+            v.x = (v.x + 1.0f) * width / 2.0f; // from world space to screen space
+            v.y = (v.y + 1.0f) * height / 2.0f;
+        }
+    }
+    obj_vertex_offset = vertices.size();
+    obj_face_offset += polygonOffset.back();
+
+    // every worker turns a contiguous run of polygons (across objects) into its own chunk
+    int polygonCount = polygonOffset.back();
+    int workers = 1;
+#ifdef _OPENMP
+    workers = omp_get_max_threads();
+#endif
+    while (tableChunks.size() < workers)
+        tableChunks.push_back(std::make_unique<TableChunk>());
+#pragma omp parallel for num_threads(workers) schedule(static, 1)
+    for (int w = 0; w < workers; w++)
+    {
+        auto &chunk = *tableChunks[w];
+        chunk.clear();
+        int from = (long long)polygonCount * w / workers, to = (long long)polygonCount * (w + 1) / workers;
+        int o = std::upper_bound(polygonOffset.begin(), polygonOffset.end(), from) - polygonOffset.begin() - 1;
+        for (int global = from; global < to; global++)
+        {
+            while (global >= polygonOffset[o + 1])
+                o++;
+            __buildPolygon(*objs[o], global - polygonOffset[o], vertexOffset[o], chunk);
+        }
+    }
+
+    // merge in chunk order, so the tables come out exactly as a serial build would make them
+    std::vector<int> chunkPolygonBase(workers + 1), chunkEdgeBase(workers + 1);
+    chunkPolygonBase[0] = polygonDepths.size();
+    chunkEdgeBase[0] = TotalEdgeTable.size();
+    for (int w = 0; w < workers; w++)
+    {
+        chunkPolygonBase[w + 1] = chunkPolygonBase[w] + tableChunks[w]->depths.size();
+        chunkEdgeBase[w + 1] = chunkEdgeBase[w] + tableChunks[w]->edges.size();
+    }
+    polygonDepths.resize(chunkPolygonBase[workers]);
+    polygonYStart.resize(chunkPolygonBase[workers]);
+    polygonYEnd.resize(chunkPolygonBase[workers]);
+    polygonEdgeBegin.resize(chunkPolygonBase[workers] + 1);
+    TotalEdgeTable.resize(chunkEdgeBase[workers]);
+#pragma omp parallel for num_threads(workers) schedule(static, 1)
+    for (int w = 0; w < workers; w++)
+    {
+        auto &chunk = *tableChunks[w];
+        int polygonBase = chunkPolygonBase[w], edgeBase = chunkEdgeBase[w];
+        std::copy(chunk.depths.begin(), chunk.depths.end(), polygonDepths.begin() + polygonBase);
+        std::copy(chunk.yStart.begin(), chunk.yStart.end(), polygonYStart.begin() + polygonBase);
+        std::copy(chunk.yEnd.begin(), chunk.yEnd.end(), polygonYEnd.begin() + polygonBase);
+        for (int i = 0; i < chunk.edgeEnd.size(); i++)
+            polygonEdgeBegin[polygonBase + i + 1] = edgeBase + chunk.edgeEnd[i];
+        TotalEdgeTable.place(edgeBase, chunk.edges);
+    }
+}
+
+void Scanline::TableChunk::clear()
+{
+    edges.clear();
+    depths.clear();
+    yStart.clear(), yEnd.clear(), edgeEnd.clear();
+}
+
+void Scanline::__buildPolygon(const OBJ &obj, int polygon_index, int vertexOffset, TableChunk &chunk)
+{
+    auto &indices = obj.getPolygonIndices();
+    auto &offsets = obj.getPolygonOffsets();
+    auto &polygon = chunk.polygon;
+    polygon.vertices.clear();
+    for (int i = offsets[polygon_index]; i < offsets[polygon_index + 1]; i++)
+        polygon.vertices.push_back(vertices[indices[i] + vertexOffset]);
+    // compute the plane equation
+    auto &v0 = polygon.vertices[0];
+    auto &v1 = polygon.vertices[1];
+    auto &v2 = polygon.vertices[2];
+    if (polygon.vertices.size() == 3)
+    {
         polygon.a = (v1.y - v0.y) * (v2.z - v0.z) - (v2.y - v0.y) * (v1.z - v0.z);
         polygon.b = (v1.z - v0.z) * (v2.x - v0.x) - (v2.z - v0.z) * (v1.x - v0.x);
         polygon.c = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
-        polygon.d = -(polygon.a * v0.x + polygon.b * v0.y + polygon.c * v0.z);
-        if (polygon.c == 0)
-            continue;
-        __buildActivateDeactivateTable(polygon);
     }
-    obj_vertex_offset += vertices_.size();
-    obj_face_offset += faces.size();
+    else // Newell's method, robust to collinear corners
+    {
+        polygon.a = polygon.b = polygon.c = 0.0f;
+        for (int i = 0; i < polygon.vertices.size(); i++)
+        {
+            auto &p0 = polygon.vertices[i];
+            auto &p1 = polygon.vertices[(i + 1) % polygon.vertices.size()];
+            polygon.a += (p0.y - p1.y) * (p0.z + p1.z);
+            polygon.b += (p0.z - p1.z) * (p0.x + p1.x);
+            polygon.c += (p0.x - p1.x) * (p0.y + p1.y);
+        }
+    }
+    polygon.d = -(polygon.a * v0.x + polygon.b * v0.y + polygon.c * v0.z);
+    if (polygon.c == 0)
+        return;
+    if (!__buildPolygonTable(polygon, chunk))
+        return;
+    chunk.depths.push_back({v0.x, v0.y, v0.z, -polygon.a / polygon.c, -polygon.b / polygon.c});
 }
 
 void Scanline::scanScreen()
 {
-    avgEdgeCount = 0.0f;
-    for (int y = 0; y < height; y++)
+    int bandCount = (height + BandHeight - 1) / BandHeight;
+    __buildBuckets(bandCount);
+    int workers = 1;
+#ifdef _OPENMP
+    if (use_band_parallel)
+        workers = omp_get_max_threads();
+#endif
+    band_workers = workers;
+    while (scanContexts.size() < workers)
+        scanContexts.push_back(std::make_unique<ScanContext>(width, height));
+    for (auto &context : scanContexts)
+    {
+        context->edgeCount = 0.0f, context->intervalCount = 0;
+        context->spanPixels = context->skippedPixels = 0;
+    }
+    // bands write disjoint rows, dense bands are balanced by handing them out one at a time
+#pragma omp parallel for num_threads(workers) schedule(dynamic, 1)
+    for (int band = 0; band < bandCount; band++)
+    {
+        int worker = 0;
+#ifdef _OPENMP
+        worker = omp_get_thread_num();
+#endif
+        int yEnd = (band + 1) * BandHeight < height ? (band + 1) * BandHeight : height;
+        __scanBand(*scanContexts[worker], band, band * BandHeight, yEnd);
+    }
+    avgEdgeCount = 0.0f, avgIntervalCount = 0.0f;
+    long long spanPixels = 0, skippedPixels = 0;
+    for (auto &context : scanContexts)
+    {
+        spanPixels += context->spanPixels;
+        skippedPixels += context->skippedPixels;
+        avgEdgeCount += context->edgeCount;
+        avgIntervalCount += context->intervalCount;
+        dirtyTiles.merge(context->dirtyTiles);
+        context->dirtyTiles.reset();
+    }
+    avgEdgeCount /= height;
+    avgIntervalCount /= height;
+    skippedSpanPercent = spanPixels > 0 ? 100.0f * skippedPixels / spanPixels : 0.0f;
+}
+
+void Scanline::__buildBuckets(int bandCount)
+{
+    int polygonCount = polygonYStart.size();
+    polygonTable.build(height, polygonCount, [this](int pId, auto &&add)
+                       { add(polygonYStart[pId]); });
+    bandCrossings.build(bandCount, polygonCount, [this](int pId, auto &&add)
+                        {
+                            for (int band = polygonYStart[pId] / BandHeight + 1; band * BandHeight < polygonYEnd[pId]; band++)
+                                add(band); });
+}
+
+void Scanline::__scanBand(ScanContext &context, int band, int yStart, int yEnd)
+{
+    auto &active = context.activeEdgeTable;
+    auto &activePolygons = context.activePolygonTable;
+    active.resize(0);
+    activePolygons.clear();
+    for (int i = 0; i < bandCrossings.size(band); i++)
+        __activatePolygon(context, bandCrossings[band][i], yStart);
+    for (int y = yStart; y < yEnd; y++)
     {
-        int prevAETSize = activeEdgeTable.size();
-        for (auto &eId : activeTable[y])
-            activeEdgeTable.push_back(TotalEdgeTable[eId]);
-        int tobeAdded = activeTable[y].size();
-        for (auto &eId : deactiveTable[y])
+        for (int i = 0; i < polygonTable.size(y); i++)
+            __activatePolygon(context, polygonTable[y][i], y);
+        assert(active.size() == 2 * activePolygons.size() && "active edge table not paired");
+
+        if (scan_mode == ScanMode::Interval)
+            __scanRowIntervals(context, y);
+        else
+            __scanRowZBuffer(context, y);
+        // step every active edge to the next scanline
+        int activeCount = active.size();
+        int64_t *x = active.x.data();
+        const int64_t *dx = active.dx.data();
+        int32_t *r = active.r.data(), *g = active.g.data(), *b = active.b.data();
+        const int32_t *dr = active.dr.data(), *dg = active.dg.data(), *db = active.db.data();
+#pragma omp simd
+        for (int i = 0; i < activeCount; i++)
+        {
+            x[i] += dx[i];
+            r[i] += dr[i];
+            g[i] += dg[i];
+            b[i] += db[i];
+        }
+        context.edgeCount += activePolygons.size();
+        __advanceActivePolygons(context, y + 1);
+    }
+}
+
+void Scanline::__scanRowZBuffer(ScanContext &context, int y)
+{
+    auto &active = context.activeEdgeTable;
+    if (context.activePolygonTable.empty())
+        return;
+    float *depth;
+    if (use_row_depth)
+    {
+        // one row of depth per worker, small enough to stay in cache
+        context.rowDepth.assign(width, std::numeric_limits<float>::infinity());
+        depth = context.rowDepth.data();
+    }
+    else
+        depth = zBuffer.data() + y * width; // zBuffer is empty in row depth mode
+    float *color = zBufferData + y * width;
+    if (use_span_rejection)
+    {
+        // every row starts empty, so does its coarse depth
+        int segmentCount = (width + (1 << SegmentShift) - 1) >> SegmentShift;
+        context.segmentMaxDepth.assign(segmentCount, std::numeric_limits<float>::infinity());
+        context.segmentStale.assign(segmentCount, 0);
+    }
+    for (int k = 0; k < context.activePolygonTable.size(); k++)
+    {
+        int xStart = EdgePool::ceil(active.x[2 * k]);
+        int xEnd = EdgePool::ceil(active.x[2 * k + 1]);
+        if (xStart >= xEnd)
+            continue;
+        xEnd = xEnd > width - 1 ? width - 1 : xEnd;
+        context.dirtyTiles.markRect(xStart, y, xEnd - 1, y);
+        xStart = xStart > 0 ? xStart : 0;
+        SpanShading span = __spanShading(active, k);
+        auto &plane = polygonDepths[context.activePolygonTable[k].pId];
+        float zStart = plane.at(xStart, y); // z buffer
+        float rStart = span.r + (xStart - span.x0) * span.dr; // rgb
+        float gStart = span.g + (xStart - span.x0) * span.dg;
+        float bStart = span.b + (xStart - span.x0) * span.db;
+        context.spanPixels += xEnd > xStart ? xEnd - xStart : 0;
+        bool resync = false;
+        for (int x = xStart; x < xEnd;) // fill the pixels, one row segment at a time
         {
-            bool found = false;
-            for (int i = 0; i < activeEdgeTable.size(); i++)
+            int segment = x >> SegmentShift;
+            int pieceEnd = (segment + 1) << SegmentShift;
+            pieceEnd = pieceEnd < xEnd ? pieceEnd : xEnd;
+            if (use_span_rejection)
             {
-                if (activeEdgeTable[i].eId == eId)
+                // the plane is linear, so its nearest point on the piece is one of the ends
+                float zA = plane.at(x, y), zB = plane.at(pieceEnd - 1, y);
+                if ((zA < zB ? zA : zB) >= __segmentMaxDepth(context, depth, segment))
                 {
-                    activeEdgeTable.erase(activeEdgeTable.begin() + i);
-                    found = true;
-                    break;
+                    context.skippedPixels += pieceEnd - x;
+                    x = pieceEnd;
+                    resync = true;
+                    continue;
+                }
+                context.segmentStale[segment] = 1;
+                if (resync)
+                {
+                    zStart = plane.at(x, y);
+                    rStart = span.r + (x - span.x0) * span.dr;
+                    gStart = span.g + (x - span.x0) * span.dg;
+                    bStart = span.b + (x - span.x0) * span.db;
+                    resync = false;
                 }
             }
-            if (!found)
-                assert(false && "edge not found");
-        }
-        assert(prevAETSize + tobeAdded - deactiveTable[y].size() == activeEdgeTable.size() && "active edge table size not match");
-        assert(activeEdgeTable.size() % 2 == 0 && "active edge table size not even");
-
-        std::sort(activeEdgeTable.begin(), activeEdgeTable.end(), [](const Edge &e0, const Edge &e1) -> bool
-                  { return e0.xStart < e1.xStart; });
-
-        for (int i = 0; i < activeEdgeTable.size(); i++)
-        {
-            auto &edge0 = activeEdgeTable[i];
-            if (edge0.if_paired)
-                continue;
-            edge0.if_paired = true;
-            auto &edge1 = activeEdgeTable[__findNextSamePolyEdge(edge0.pId)];
-            int xStart = std::ceil(edge0.xStart);
-            int xEnd = std::ceil(edge1.xStart);
-            if (xStart == xEnd)
-                continue;
-            float zStart = edge0.zStart; // z buffer
-            float rStart = edge0.rStart; // rgb
-            float gStart = edge0.gStart;
-            float bStart = edge0.bStart;
-            float zEnd = edge1.zStart;
-            float rEnd = edge1.rStart;
-            float gEnd = edge1.gStart;
-            float bEnd = edge1.bStart;
-            float zSlope = (zEnd - zStart) / (edge1.xStart - edge0.xStart);
-            float rSlope = (rEnd - rStart) / (edge1.xStart - edge0.xStart);
-            float gSlope = (gEnd - gStart) / (edge1.xStart - edge0.xStart);
-            float bSlope = (bEnd - bStart) / (edge1.xStart - edge0.xStart);
-            zStart = zStart + (xStart - edge0.xStart) * zSlope;
-            rStart = rStart + (xStart - edge0.xStart) * rSlope;
-            gStart = gStart + (xStart - edge0.xStart) * gSlope;
-            bStart = bStart + (xStart - edge0.xStart) * bSlope;
-            xEnd = xEnd > width - 1 ? width - 1 : xEnd;
-            for (int x = (xStart > 0 ? xStart : 0); x < xEnd; x++) // fill the pixels
+            for (; x < pieceEnd; x++)
             {
-                if (zBuffer[y * width + x] > zStart) // depth test
+                if (depth[x] > zStart) // depth test
                 {
-                    zBuffer[y * width + x] = zStart;
-                    // normalize the color
-                    float dist = std::sqrt(rStart * rStart + gStart * gStart + bStart * bStart);
-                    int r_ = std::round(rStart / dist * 255);
-                    int g_ = std::round(gStart / dist * 255);
-                    int b_ = std::round(bStart / dist * 255);
-                    Uchar rc = r_ > 255 ? 255 : (r_ < 0 ? 0 : r_);
-                    Uchar gc = g_ > 255 ? 255 : (g_ < 0 ? 0 : g_);
-                    Uchar bc = b_ > 255 ? 255 : (b_ < 0 ? 0 : b_);
-                    Uchar ac = 255;
-                    float value = SCRA::Utils::encodeCharsToFloat(rc, gc, bc, ac);
-                    zBufferData[y * width + x] = value;
+                    depth[x] = zStart;
+                    color[x] = __encodeNormal(rStart, gStart, bStart);
                 }
-                zStart += zSlope;
-                rStart += rSlope;
-                gStart += gSlope;
-                bStart += bSlope;
+                zStart += plane.zDx;
+                rStart += span.dr;
+                gStart += span.dg;
+                bStart += span.db;
             }
         }
-        for (auto &e : activeEdgeTable)
-        {
-            e.xStart += e.xSlope;
-            e.zStart += e.zSlope;
-            e.rStart += e.rSlope;
-            e.gStart += e.gSlope;
-            e.bStart += e.bSlope;
-            e.if_paired = false;
-        }
-        avgEdgeCount += activeEdgeTable.size() / 2.0f;
     }
-    avgEdgeCount /= height;
 }
 
-void Scanline::__buildActivateDeactivateTable(Polygon &polygon)
+float Scanline::__segmentMaxDepth(ScanContext &context, const float *depth, int segment) const
 {
+    // recomputed only when the segment was written since the last query
+    if (context.segmentStale[segment])
+    {
+        int xEnd = (segment + 1) << SegmentShift;
+        xEnd = xEnd < width ? xEnd : width;
+        float maxDepth = -std::numeric_limits<float>::infinity();
+        for (int x = segment << SegmentShift; x < xEnd; x++)
+            maxDepth = depth[x] > maxDepth ? depth[x] : maxDepth;
+        context.segmentMaxDepth[segment] = maxDepth;
+        context.segmentStale[segment] = 0;
+    }
+    return context.segmentMaxDepth[segment];
+}
+
+Scanline::SpanShading Scanline::__spanShading(const EdgePool &active, int k) const
+{
+    int e0 = 2 * k, e1 = 2 * k + 1; // left and right edge
+    SpanShading span;
+    span.x0 = EdgePool::toFloat(active.x[e0]);
+    float x1 = EdgePool::toFloat(active.x[e1]);
+    span.r = EdgePool::toFloat(active.r[e0]);
+    span.g = EdgePool::toFloat(active.g[e0]);
+    span.b = EdgePool::toFloat(active.b[e0]);
+    span.dr = (EdgePool::toFloat(active.r[e1]) - span.r) / (x1 - span.x0);
+    span.dg = (EdgePool::toFloat(active.g[e1]) - span.g) / (x1 - span.x0);
+    span.db = (EdgePool::toFloat(active.b[e1]) - span.b) / (x1 - span.x0);
+    return span;
+}
+
+float Scanline::__encodeNormal(float r, float g, float b)
+{
+    // normalize the color
+    float dist = std::sqrt(r * r + g * g + b * b);
+    int r_ = std::round(r / dist * 255);
+    int g_ = std::round(g / dist * 255);
+    int b_ = std::round(b / dist * 255);
+    Uchar rc = r_ > 255 ? 255 : (r_ < 0 ? 0 : r_);
+    Uchar gc = g_ > 255 ? 255 : (g_ < 0 ? 0 : g_);
+    Uchar bc = b_ > 255 ? 255 : (b_ < 0 ? 0 : b_);
+    Uchar ac = 255;
+    return SCRA::Utils::encodeCharsToFloat(rc, gc, bc, ac);
+}
+
+void Scanline::__activatePolygon(ScanContext &context, int pId, int y)
+{
+    // enter with the two edges covering scanline y, on the polygon's first scanline these are its first two edges
+    auto &edges = TotalEdgeTable;
+    int pair[2], count = 0;
+    int e = polygonEdgeBegin[pId], end = polygonEdgeBegin[pId + 1];
+    for (; e < end && edges.yStart[e] <= y; e++)
+        if (edges.yEnd[e] > y && count < 2)
+            pair[count++] = e;
+    if (count < 2)
+        return;
+    __orderEdgePair(pair[0], pair[1], y);
+    int slot = context.activeEdgeTable.size();
+    context.activeEdgeTable.set(slot, edges, pair[0], y);
+    context.activeEdgeTable.set(slot + 1, edges, pair[1], y);
+    context.activePolygonTable.push_back({pId, e, end});
+}
+
+void Scanline::__advanceActivePolygons(ScanContext &context, int y)
+{
+    // replace the edges that end before scanline y by the next edges of their polygon, drop finished polygons
+    auto &edges = TotalEdgeTable;
+    auto &active = context.activeEdgeTable;
+    int count = 0;
+    for (int k = 0; k < context.activePolygonTable.size(); k++)
+    {
+        auto polygon = context.activePolygonTable[k];
+        bool leftEnded = active.yEnd[2 * k] == y, rightEnded = active.yEnd[2 * k + 1] == y;
+        int left = -1, right = -1;
+        if (leftEnded && polygon.nextEdge < polygon.edgeEnd)
+            left = polygon.nextEdge++;
+        if (rightEnded && polygon.nextEdge < polygon.edgeEnd)
+            right = polygon.nextEdge++;
+        if ((leftEnded && left < 0) || (rightEnded && right < 0))
+            continue;
+        if (leftEnded && rightEnded)
+            __orderEdgePair(left, right, y);
+        // compact, the kept pair moves from slot k to slot count
+        if (leftEnded)
+            active.set(2 * count, edges, left, y);
+        else
+            active.move(2 * count, 2 * k);
+        if (rightEnded)
+            active.set(2 * count + 1, edges, right, y);
+        else
+            active.move(2 * count + 1, 2 * k + 1);
+        context.activePolygonTable[count] = polygon;
+        count++;
+    }
+    context.activePolygonTable.resize(count);
+    active.resize(2 * count);
+}
+
+void Scanline::__orderEdgePair(int &left, int &right, int y) const
+{
+    auto &edges = TotalEdgeTable;
+    int64_t xLeft = edges.xAt(left, y), xRight = edges.xAt(right, y);
+    if (xRight < xLeft || (xRight == xLeft && edges.dx[right] < edges.dx[left]))
+        std::swap(left, right);
+}
+
+bool Scanline::__buildPolygonTable(Polygon &polygon, TableChunk &chunk)
+{
+    auto &pendingEdges = chunk.pendingEdges;
+    pendingEdges.clear();
     for (int i = 0; i < polygon.vertices.size(); i++) // for each edge
     {
-        auto &v0_ = polygon.vertices[i];
-        auto &v1_ = polygon.vertices[(i + 1) % polygon.vertices.size()];
-        auto v0 = v0_;
-        auto v1 = v1_;
+        auto &v0 = polygon.vertices[i];
+        auto &v1 = polygon.vertices[(i + 1) % polygon.vertices.size()];
         // if the edge is horizontal, ignore it
         if (std::fabs(v0.y - v1.y) < SCRA::Config::EPSILON)
             continue;
         // if the edge is not intersecting with the scanline, ignore it
         if (std::ceil(v0.y) == std::ceil(v1.y))
             continue;
-        if (v0.y > v1.y)
-            std::swap(v0, v1);
-        float y_ac_f = v0.y;
-        float y_de_f = v1.y;
+        float y_ac_f = v0.y < v1.y ? v0.y : v1.y;
+        float y_de_f = v0.y < v1.y ? v1.y : v0.y;
         if (y_ac_f >= height - 1 || y_de_f <= 0)
             continue;
         int y_ac = std::ceil(y_ac_f <= 0.0 ? 0 : y_ac_f);
         int y_de = std::ceil(y_de_f >= height - 1 ? height - 1 : y_de_f);
         if (y_ac == y_de)
             continue;
-
-        Edge edge(v0, v1, edgeIdCounter++);
-        activeTable[y_ac].push_back(edge.eId);
-        deactiveTable[y_de].push_back(edge.eId);
-        edge.edgeStepToIntegerY(y_ac);
-        edge.pId = polygon.pid;
-        TotalEdgeTable.push_back(edge);
+        pendingEdges.push_back({i, y_ac, y_de});
     }
-}
-
-int Scanline::__findNextSamePolyEdge(int pId)
-{
-    for (int i = 0; i < activeEdgeTable.size(); i++)
-        if (activeEdgeTable[i].pId == pId && activeEdgeTable[i].if_paired == false)
-        {
-            activeEdgeTable[i].if_paired = true;
-            return i;
-        }
-    assert(false && "edge not paired correctly");
-    return -1;
+    if (pendingEdges.size() < 2)
+        return false;
+    // edges of a polygon are stored by first scanline, so an ended edge is replaced by the next one
+    std::sort(pendingEdges.begin(), pendingEdges.end(), [](const PendingEdge &e0, const PendingEdge &e1) -> bool
+              { return e0.yStart < e1.yStart; });
+    for (auto &pending : pendingEdges)
+    {
+        auto v0 = polygon.vertices[pending.i];
+        auto v1 = polygon.vertices[(pending.i + 1) % polygon.vertices.size()];
+        if (v0.y > v1.y)
+            std::swap(v0, v1);
+        chunk.edges.push(v0, v1, pending.yStart, pending.yEnd);
+    }
+    chunk.edgeEnd.push_back(chunk.edges.size());
+    int yEnd = pendingEdges[0].yEnd;
+    for (auto &pending : pendingEdges)
+        yEnd = pending.yEnd > yEnd ? pending.yEnd : yEnd;
+    chunk.yStart.push_back(pendingEdges[0].yStart);
+    chunk.yEnd.push_back(yEnd);
+    return true;
 }
@@ -72,9 +72,11 @@ void ScanlineRaster::__ScanLinePreInit()
 void ScanlineRaster::__ScanLinePreCompute()
 {
     scanline->init();
+    std::vector<OBJ *> objs;
     for (int i = 0; i < scene->objs.size(); i++)
         if (scene->obj_activated[i])
-            scanline->buildTable(*scene->objs[i], scene->getCameraV());
+            objs.push_back(scene->objs[i].get());
+    scanline->buildTables(objs, scene->getCameraV());
     scanline->scanScreen();
 
     if (isGPU)
@@ -107,6 +109,23 @@ void ScanlineRaster::__showScanlineDataStructInfo()
     _showimguiSubTitle("Scan Line Z-Buffer Info");
     ImGui::Text("Vertex Count: %d", scanline->vertices.size());
     ImGui::Text("Edge Count: %d", scanline->TotalEdgeTable.size());
-    ImGui::Text("Average Active Edge Count: %f", scanline->avgEdgeCount);
+    ImGui::Text("Average Active Polygon Count: %f", scanline->avgEdgeCount);
+    ImGui::Text("Hidden Surface:");
+    if (ImGui::RadioButton("Z-Buffer", scanline->scan_mode == Scanline::ScanMode::ZBuffer))
+        scanline->scan_mode = Scanline::ScanMode::ZBuffer;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Interval", scanline->scan_mode == Scanline::ScanMode::Interval))
+        scanline->scan_mode = Scanline::ScanMode::Interval;
+    if (scanline->scan_mode == Scanline::ScanMode::Interval)
+        ImGui::Text("Average Interval Count: %f", scanline->avgIntervalCount);
+    if (scanline->scan_mode == Scanline::ScanMode::ZBuffer)
+    {
+        ImGui::Checkbox("Use Single Row Depth", &scanline->use_row_depth);
+        ImGui::Checkbox("Use Span Rejection", &scanline->use_span_rejection);
+        if (scanline->use_span_rejection)
+            ImGui::Text("Skipped Span Pixels: %.1f%%", scanline->skippedSpanPercent);
+    }
+    ImGui::Checkbox("Use Band Parallel", &scanline->use_band_parallel);
+    ImGui::Text("Band Workers: %d", scanline->band_workers);
     // use cull face
 }
\ No newline at end of file